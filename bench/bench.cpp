@@ -0,0 +1,547 @@
+#include "config.h"
+#include "globals.h"
+
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <Arduino.h>
+#include <Adafruit_NeoPixel.h>
+#include <Preferences.h>
+#include <mqtt_client.h>
+
+#include "actionQueue.h"
+#include "metrics.h"
+#include "mqttEventProcessing.h"
+#include "mqttRouter.h"
+#include "network.h"
+#include "neoPixelRing.h"
+#include "render.h"
+#include "ringState.h"
+#include "segment.h"
+#include "stateStore.h"
+#include "statusPublisher.h"
+#include "shim.h"
+
+// Replays a recorded trace of mqtt messages through the processing pipeline
+// on the host and reports what every stage cost. The firmware's tasks are
+// never started, the bench steps them itself against a fake clock:
+//
+//   pio run -e native && .pio/build/native/program bench/traces/dashboard.txt
+//
+// Trace lines are "<ms since the previous message> <topic> <payload>", a
+// payload starting with "hex:" is sent as raw bytes. Lines starting with #
+// are ignored.
+
+#define BENCH_DEFAULT_TRACE "bench/traces/dashboard.txt"
+#define BENCH_MAX_SAMPLES   4096
+#define BENCH_LINE_LEN      512
+#define BENCH_PAYLOAD_LEN   256
+
+//==============================================================================
+// Globals
+
+TaskHandle_t mqttTaskHandle = NULL;
+TaskHandle_t processShortTaskHandle = NULL;
+TaskHandle_t processLongTaskHandle = NULL;
+TaskHandle_t renderTaskHandle = NULL;
+
+QueueHandle_t shortActionQueue = NULL;
+QueueHandle_t longActionQueue = NULL;
+
+esp_mqtt_client_handle_t mqttClient = NULL;
+
+// network.cpp isn't built, the bench's client never disconnects and only
+// counts the reconnects it's asked for
+static uint32_t reconnects = 0;
+
+void reconnectMqtt(void)
+{
+    reconnects++;
+}
+
+//==============================================================================
+// Allocations
+
+// Every heap allocation the firmware makes goes through here, the hot path
+// is meant to make none
+static uint32_t allocations = 0;
+static uint32_t allocatedBytes = 0;
+
+void *operator new(size_t size)
+{
+    void *ptr = malloc(size ? size : 1);
+
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    allocations++;
+    allocatedBytes += size;
+
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+//==============================================================================
+// Stages
+
+typedef enum {
+    STAGE_ROUTE = 0,   // Topic lookup on its own
+    STAGE_HANDLER = 1, // mqtt_event_handler(), lookup + parse + enqueue
+    STAGE_SHORT = 2,   // One action on the short task
+    STAGE_LONG = 3,    // One action on the long task
+    STAGE_RENDER = 4,  // One render frame
+    STAGE_COUNT = 5,
+} BenchStage_t;
+
+static const char *stageNames[STAGE_COUNT] = {"route", "handler", "short", "long", "render"};
+
+typedef struct {
+    uint32_t count;
+    uint32_t allocations;
+    uint32_t allocatedBytes;
+    uint64_t cycles;
+    uint32_t ns[BENCH_MAX_SAMPLES];
+} BenchStats_t;
+
+static BenchStats_t stats[STAGE_COUNT];
+
+typedef struct {
+    uint64_t ns;
+    uint64_t cycles;
+    uint32_t allocations;
+    uint32_t allocatedBytes;
+} BenchSample_t;
+
+static uint64_t wallNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void stageStart(BenchSample_t *sample)
+{
+    sample->allocations = allocations;
+    sample->allocatedBytes = allocatedBytes;
+    sample->cycles = cycles();
+    sample->ns = wallNs();
+}
+
+static void stageEnd(BenchStage_t stage, BenchSample_t *sample)
+{
+    uint64_t ns = wallNs() - sample->ns;
+    BenchStats_t *stat = &stats[stage];
+
+    stat->cycles += cycles() - sample->cycles;
+    stat->allocations += allocations - sample->allocations;
+    stat->allocatedBytes += allocatedBytes - sample->allocatedBytes;
+    if (stat->count < BENCH_MAX_SAMPLES) {
+        stat->ns[stat->count] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+    }
+    stat->count++;
+}
+
+static int compareSamples(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void printStats(void)
+{
+    uint32_t samples;
+    uint64_t total;
+    uint32_t i;
+    uint8_t stage;
+
+    printf("\n%-8s %8s %10s %10s %10s %10s %12s %8s %10s\n",
+        "stage", "count", "mean ns", "p50 ns", "p99 ns", "max ns", "mean cycles", "allocs", "bytes");
+
+    for (stage = 0; stage < STAGE_COUNT; stage++) {
+        BenchStats_t *stat = &stats[stage];
+
+        if (!stat->count) {
+            printf("%-8s %8u\n", stageNames[stage], 0u);
+            continue;
+        }
+
+        samples = stat->count < BENCH_MAX_SAMPLES ? stat->count : BENCH_MAX_SAMPLES;
+        qsort(stat->ns, samples, sizeof(uint32_t), compareSamples);
+        for (i = 0, total = 0; i < samples; i++) {
+            total += stat->ns[i];
+        }
+
+        printf("%-8s %8u %10llu %10u %10u %10u %12llu %8u %10u\n",
+            stageNames[stage],
+            stat->count,
+            (unsigned long long)(total / samples),
+            stat->ns[samples / 2],
+            stat->ns[(samples * 99) / 100],
+            stat->ns[samples - 1],
+            (unsigned long long)(stat->cycles / stat->count),
+            stat->allocations,
+            stat->allocatedBytes);
+    }
+}
+
+//==============================================================================
+// Checks
+
+// The brightness each segment was last asked for. Every JSON status that goes
+// out after that has to carry it, one that doesn't was built from a snapshot
+// the render task hadn't caught up with yet.
+static uint8_t expectedBrightness[SEGMENT_COUNT];
+static uint32_t statusChecks = 0;
+static uint32_t staleStatuses = 0;
+static uint32_t statusPublishes[SEGMENT_COUNT];
+static uint32_t metricsPublishes = 0;
+
+static void checkPublish(const char *topic, const char *data, int length)
+{
+    char payload[BENCH_PAYLOAD_LEN];
+    char statusTopic[SEGMENT_TOPIC_LEN];
+    const char *brightness;
+    uint8_t segment;
+
+    if (strcmp(topic, PUB_METRICS) == 0) {
+        metricsPublishes++;
+        return;
+    }
+
+    for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+        segmentTopic(statusTopic, PUB_GET_COLOR, segment);
+        if (strcmp(topic, statusTopic) == 0) {
+            break;
+        }
+    }
+    if (segment == SEGMENT_COUNT || length >= (int)sizeof(payload)) {
+        return;
+    }
+
+    memcpy(payload, data, length);
+    payload[length] = '\0';
+    brightness = strstr(payload, "\"brightness\":");
+
+    statusPublishes[segment]++;
+    statusChecks++;
+    if (!brightness || strtoul(brightness + strlen("\"brightness\":"), NULL, 10) != expectedBrightness[segment]) {
+        staleStatuses++;
+    }
+}
+
+//==============================================================================
+// Pipeline
+
+static uint8_t wasAnimating = 0; // Bit per segment
+
+static void runShortAction(SubscriptionAction_t *action)
+{
+    BenchSample_t sample;
+
+    if (action->type == SET_BRIGHTNESS) {
+        expectedBrightness[action->segment] = action->brightness;
+    }
+
+    stageStart(&sample);
+    processShortAction(action);
+    processShortSignals();
+    stageEnd(STAGE_SHORT, &sample);
+}
+
+// Same order as processShortTask(), the signals and then the queue
+static void drainQueues(void)
+{
+    SubscriptionAction_t action;
+    BenchSample_t sample;
+
+    // The short task has the higher priority, so it always goes first
+    processShortSignals();
+    while (xQueueReceive(shortActionQueue, &action, 0) == pdTRUE) {
+        runShortAction(&action);
+    }
+
+    while (xQueueReceive(longActionQueue, &action, 0) == pdTRUE) {
+        stageStart(&sample);
+        processLongAction(&action);
+        stageEnd(STAGE_LONG, &sample);
+
+        processShortSignals();
+        while (xQueueReceive(shortActionQueue, &action, 0) == pdTRUE) {
+            runShortAction(&action);
+        }
+    }
+}
+
+// Runs the render task (and anything its frames queue) until the fake clock
+// has moved on by ms
+static void runFor(uint32_t ms)
+{
+    int64_t until = shimNow() + (int64_t)ms * 1000;
+    BenchSample_t sample;
+    uint8_t isAnimating;
+    uint8_t segment;
+
+    while (shimNow() + RENDER_FRAME_MS * 1000 <= until) {
+        shimAdvanceTime(RENDER_FRAME_MS * 1000);
+        shimRunTimers();
+        drainQueues();
+
+        stageStart(&sample);
+        isAnimating = renderFrame();
+        stageEnd(STAGE_RENDER, &sample);
+
+        for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+            if ((wasAnimating & ~isAnimating) & (1 << segment)) {
+                queueRgbStatus(segment);
+            }
+        }
+        wasAnimating = isAnimating;
+        drainQueues();
+    }
+
+    shimAdvanceTime(until - shimNow());
+}
+
+static void sendMessage(char *topic, char *payload, int payloadLength)
+{
+    esp_mqtt_event_t event;
+    BenchSample_t sample;
+    uint8_t segment;
+
+    memset(&event, 0, sizeof(esp_mqtt_event_t));
+    event.event_id = MQTT_EVENT_DATA;
+    event.client = mqttClient;
+    event.topic = topic;
+    event.topic_len = strlen(topic);
+    event.data = payload;
+    event.data_len = payloadLength;
+    event.total_data_len = payloadLength;
+
+    stageStart(&sample);
+    findMqttRoute(event.topic, event.topic_len, &segment);
+    stageEnd(STAGE_ROUTE, &sample);
+
+    stageStart(&sample);
+    mqtt_event_handler(NULL, "MQTT_EVENTS", MQTT_EVENT_DATA, &event);
+    stageEnd(STAGE_HANDLER, &sample);
+
+    drainQueues();
+}
+
+//==============================================================================
+// Trace
+
+static int decodeHex(const char *hex, char *output, int length)
+{
+    int count = 0;
+    unsigned int byte;
+
+    while (hex[0] && hex[1] && count < length && sscanf(hex, "%2x", &byte) == 1) {
+        output[count++] = (char)byte;
+        hex += 2;
+    }
+
+    return count;
+}
+
+static uint32_t replayTrace(FILE *trace)
+{
+    char line[BENCH_LINE_LEN];
+    char payload[BENCH_PAYLOAD_LEN];
+    char *topic;
+    char *data;
+    char *end;
+    unsigned long wait;
+    int payloadLength;
+    uint32_t messages = 0;
+
+    while (fgets(line, sizeof(line), trace)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0') {
+            continue;
+        }
+
+        wait = strtoul(line, &end, 10);
+        topic = end + strspn(end, " ");
+        data = topic + strcspn(topic, " ");
+        if (*data) {
+            *data++ = '\0';
+        }
+
+        if (strncmp(data, "hex:", 4) == 0) {
+            payloadLength = decodeHex(data + 4, payload, sizeof(payload));
+        } else {
+            payloadLength = strlen(data) < sizeof(payload) ? strlen(data) : sizeof(payload);
+            memcpy(payload, data, payloadLength);
+        }
+
+        runFor(wait);
+        sendMessage(topic, payload, payloadLength);
+        messages++;
+    }
+
+    // Let the last fades finish, the status flush and the state store
+    runFor(STATE_STORE_DELAY_MS + 1000);
+
+    return messages;
+}
+
+//==============================================================================
+// Flood
+
+static void sendRaw(const char *topic, const char *payload)
+{
+    esp_mqtt_event_t event;
+
+    memset(&event, 0, sizeof(esp_mqtt_event_t));
+    event.event_id = MQTT_EVENT_DATA;
+    event.client = mqttClient;
+    event.topic = (char *)topic;
+    event.topic_len = strlen(topic);
+    event.data = (char *)payload;
+    event.data_len = strlen(payload);
+    event.total_data_len = event.data_len;
+
+    mqtt_event_handler(NULL, "MQTT_EVENTS", MQTT_EVENT_DATA, &event);
+}
+
+// Keeps the short queue full of polls from the mqtt side while every timer
+// runs out and the render task asks for a status. Returns how many of those
+// never made it.
+static uint32_t floodShortQueue(uint32_t *depth)
+{
+    static const char *polls[] = {SUB_GET_COLOR, SUB_GET_COLOR "/1", SUB_GET_COLOR_BIN, SUB_GET_COLOR_BIN "/1"};
+    uint32_t writes, metrics, segment0, segment1;
+    uint32_t lost = 0;
+    uint8_t i;
+
+    // A status that's held back by the rate limit, so the flush timer is
+    // running, and a segment 1 command the render task hasn't applied yet
+    sendRaw(SUB_SET_COLOR, "{\"r\": 10, \"g\": 20, \"b\": 30}");
+    drainQueues();
+    runFor(RENDER_FRAME_MS);
+    sendRaw(SUB_SET_COLOR, "{\"r\": 11, \"g\": 21, \"b\": 31}");
+    drainQueues();
+    runFor(RENDER_FRAME_MS);
+    sendRaw(SUB_SET_COLOR "/1", "{\"r\": 5, \"g\": 6, \"b\": 7}");
+    drainQueues();
+
+    writes = Preferences::getWrites();
+    metrics = metricsPublishes;
+    segment0 = statusPublishes[0];
+    segment1 = statusPublishes[1];
+
+    // Nothing is drained from here on, so the coalesce and drop paths run
+    for (i = 0; i < SHORT_ACTION_QUEUE_LENGTH * 4; i++) {
+        sendRaw(polls[i % 4], "{}");
+    }
+    *depth = uxQueueMessagesWaiting(shortActionQueue);
+
+    renderFrame();
+    signalShortTask(SIGNAL_RECONNECT_MQTT); // network.cpp's backoff timer isn't built
+    shimAdvanceTime((int64_t)METRICS_INTERVAL_MS * 1000);
+    shimRunTimers();
+
+    drainQueues();
+
+    lost += Preferences::getWrites() == writes;  // STORE_STATE
+    lost += metricsPublishes == metrics;         // PUBLISH_METRICS
+    lost += statusPublishes[0] == segment0;      // FLUSH_STATUS
+    lost += statusPublishes[1] == segment1;      // PUBLISH_STATUS
+    lost += reconnects != 1;                     // RECONNECT_MQTT
+
+    return lost;
+}
+
+//==============================================================================
+// Main
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : BENCH_DEFAULT_TRACE;
+    FILE *trace = fopen(path, "r");
+    uint32_t messages;
+    uint32_t setupAllocations;
+    uint32_t floodDepth;
+    uint32_t floodLost;
+    uint8_t segment;
+
+    if (!trace) {
+        fprintf(stderr, "Failed to open the trace %s\n", path);
+        return 1;
+    }
+
+    // Same order as setup(), minus wifi and the tasks
+    shortActionQueue = xQueueCreate(SHORT_ACTION_QUEUE_LENGTH, sizeof(SubscriptionAction_t));
+    longActionQueue = xQueueCreate(LONG_ACTION_QUEUE_LENGTH, sizeof(SubscriptionAction_t));
+    if (!shortActionQueue || !longActionQueue || !initStatusPublisher() || !initMetrics() || !initStateStore()) {
+        fprintf(stderr, "Failed to set up the pipeline\n");
+        return 1;
+    }
+
+    initSegments();
+    shimSetWaitHook(applyRenderCommands);
+    shimSetPublishHook(checkPublish);
+    for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+        expectedBrightness[segment] = NEO_PIXEL_BRIGHTNESS;
+        segments[segment].ring->setGammaCorrection(NEO_PIXEL_GAMMA);
+        segments[segment].ring->setBrightness(NEO_PIXEL_BRIGHTNESS);
+        segments[segment].ring->begin();
+        updateRingState(segment);
+    }
+    initMqttRoutes();
+
+    setupAllocations = allocations;
+    messages = replayTrace(trace);
+    fclose(trace);
+    floodLost = floodShortQueue(&floodDepth);
+
+    printf("trace: %s\n", path);
+    printf("messages: %u, simulated: %lld ms\n", messages, (long long)(shimNow() / 1000));
+    for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+        printf("segment %u frames shown: %u, skipped: %u, pixel writes: %u\n", segment,
+            segments[segment].ring->getFramesShown(), segments[segment].ring->getFramesSkipped(),
+            segments[segment].pixels->getShowCount());
+    }
+    printf("publishes: %u (%u bytes)\n", shimPublishCount(), shimPublishBytes());
+    printf("nvs writes: %u\n", Preferences::getWrites());
+    printf("status checks: %u, stale brightness: %u\n", statusChecks, staleStatuses);
+    printf("flood: short queue at %u/%u, internal actions lost: %u\n", floodDepth, SHORT_ACTION_QUEUE_LENGTH, floodLost);
+    printf("allocations: %u during setup, %u while replaying\n", setupAllocations, allocations - setupAllocations);
+    printStats();
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef __RGB_DINO_SHIM_ADAFRUIT_NEOPIXEL_H__
+#define __RGB_DINO_SHIM_ADAFRUIT_NEOPIXEL_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#define NEO_GRB    ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_KHZ800 0x0000
+
+// Keeps the pixels in memory and counts the shows instead of clocking them out
+class Adafruit_NeoPixel
+{
+    private:
+        uint16_t numLEDs;
+        uint8_t *pixels;
+        uint32_t shows;
+
+    public:
+        Adafruit_NeoPixel(uint16_t n, int16_t pin, uint16_t type): numLEDs(n), pixels(new uint8_t[n * 3]()), shows(0) {}
+        ~Adafruit_NeoPixel() { delete[] pixels; }
+
+        void begin(void) {}
+        void show(void) { shows++; }
+        void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b)
+        {
+            if (n < numLEDs) {
+                pixels[n * 3] = r;
+                pixels[n * 3 + 1] = g;
+                pixels[n * 3 + 2] = b;
+            }
+        }
+        uint32_t getPixelColor(uint16_t n) const
+        {
+            return n < numLEDs ? Color(pixels[n * 3], pixels[n * 3 + 1], pixels[n * 3 + 2]) : 0;
+        }
+        uint16_t numPixels(void) const { return numLEDs; }
+        uint8_t *getPixels(void) const { return pixels; }
+        uint32_t getShowCount(void) const { return shows; }
+        static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __RGB_DINO_SHIM_ARDUINO_H__
+#define __RGB_DINO_SHIM_ARDUINO_H__
+
+// The bits of the Arduino core the firmware uses, backed by stdio and the
+// fake clock in shim.cpp
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define PROGMEM
+
+class HardwareSerial
+{
+    public:
+        void begin(unsigned long baud) {}
+        void print(const char *message) { fputs(message, stdout); }
+        void print(const __FlashStringHelper *message) { print(reinterpret_cast<const char *>(message)); }
+        void print(char value) { putchar(value); }
+        void print(int value) { printf("%d", value); }
+        void print(unsigned int value) { printf("%u", value); }
+        void print(long value) { printf("%ld", value); }
+        void print(unsigned long value) { printf("%lu", value); }
+        void print(double value) { printf("%.2f", value); }
+        template <typename T> void println(T message) { print(message); println(); }
+        void println(void) { putchar('\n'); }
+        int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HardwareSerial Serial;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(uint32_t ms);
+long map(long x, long inMin, long inMax, long outMin, long outMax);
+
+// Starts SNTP on the device, does nothing here
+void configTime(long gmtOffset, int daylightOffset, const char *server);
+
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif
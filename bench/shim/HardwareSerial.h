@@ -0,0 +1,6 @@
+#ifndef __RGB_DINO_SHIM_HARDWARE_SERIAL_H__
+#define __RGB_DINO_SHIM_HARDWARE_SERIAL_H__
+
+#include <Arduino.h>
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __RGB_DINO_SHIM_PREFERENCES_H__
+#define __RGB_DINO_SHIM_PREFERENCES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SHIM_PREFERENCES_KEYS 8
+#define SHIM_PREFERENCES_VALUE_LEN 512
+
+// NVS in memory, every instance shares the same keys. Counts writes so the
+// bench can show how often the firmware would have hit flash.
+class Preferences {
+public:
+    bool begin(const char *name, bool readOnly = false, const char *partition = NULL) { return true; }
+    void end(void) {}
+
+    bool remove(const char *key)
+    {
+        Entry *entry = find(key, false);
+
+        if (entry) {
+            entry->key[0] = '\0';
+        }
+
+        return entry != NULL;
+    }
+
+    size_t putBytes(const char *key, const void *value, size_t length)
+    {
+        Entry *entry = find(key, true);
+
+        if (!entry || length > SHIM_PREFERENCES_VALUE_LEN) {
+            return 0;
+        }
+        memcpy(entry->value, value, length);
+        entry->length = length;
+        writes++;
+
+        return length;
+    }
+
+    size_t getBytes(const char *key, void *buffer, size_t length)
+    {
+        Entry *entry = find(key, false);
+
+        if (!entry || entry->length > length) {
+            return 0;
+        }
+        memcpy(buffer, entry->value, entry->length);
+
+        return entry->length;
+    }
+
+    static uint32_t getWrites(void) { return writes; }
+
+private:
+    struct Entry {
+        char key[16];
+        size_t length;
+        uint8_t value[SHIM_PREFERENCES_VALUE_LEN];
+    };
+
+    static Entry *find(const char *key, bool create)
+    {
+        Entry *empty = NULL;
+
+        for (uint8_t i = 0; i < SHIM_PREFERENCES_KEYS; i++) {
+            if (strncmp(entries[i].key, key, sizeof(entries[i].key)) == 0) {
+                return &entries[i];
+            }
+            if (!empty && entries[i].key[0] == '\0') {
+                empty = &entries[i];
+            }
+        }
+
+        if (create && empty) {
+            strncpy(empty->key, key, sizeof(empty->key) - 1);
+            empty->key[sizeof(empty->key) - 1] = '\0';
+        }
+
+        return create ? empty : NULL;
+    }
+
+    static Entry entries[SHIM_PREFERENCES_KEYS];
+    static uint32_t writes;
+};
+
+#endif
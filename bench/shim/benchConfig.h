@@ -0,0 +1,61 @@
+#ifndef __RGB_DINO_CONFIG_H__
+#define __RGB_DINO_CONFIG_H__
+
+// Forced in ahead of everything by the native env, so the bench always runs
+// the same topics whatever is in include/config.h
+
+#include <soc/soc.h>
+
+// Debug
+#define DEBUG          false
+#define APP_DEBUG      false
+#define APP_MQTT_DEBUG false
+#define APP_LATENCY_DEBUG false
+#define APP_TRACE      false
+
+// Wifi
+#define WLAN_SSID      ""
+#define WLAN_PASS      ""
+
+// MQTT
+#define MQTT_URI       "mqtt://0.0.0.0:1883"
+#define MQTT_USER      ""
+#define MQTT_PASS      ""
+
+// Subscription Topics
+#define SUB_GET_COLOR      "dino/get"
+#define SUB_SET_COLOR      "dino/set"
+#define SUB_SET_BRIGHTNESS "dino/brightness"
+#define SUB_SET_EFFECT     "dino/effect"
+#define SUB_GET_COLOR_BIN  "dino/bin/get"
+#define SUB_SET_COLOR_BIN  "dino/bin/set"
+#define SUB_STREAM         "dino/stream"
+
+// Groups
+#define MQTT_GROUP_TOPICS  "rgb/all", "rgb/den"
+
+// Publish Topics
+#define PUB_GET_COLOR      "dino/status"
+#define PUB_GET_COLOR_BIN  "dino/bin/status"
+#define PUB_METRICS        "dino/metrics"
+
+// Processing
+#define COALESCE_SET_COLOR true
+#define STATUS_PUBLISH_MAX_RATE 5
+#define STATUS_PUBLISH_RETAIN false
+
+// Pins
+#define NEO_PIXEL_PIN   14
+#define NEO_PIXEL_COUNT 12
+
+// Segments
+#define SEGMENT_COUNT   2
+#define SEGMENT_1_PIN   15
+#define SEGMENT_1_COUNT 30
+
+// Neo pixel output
+#define NEO_PIXEL_GAMMA      true
+#define NEO_PIXEL_BRIGHTNESS 255
+#define NEO_PIXEL_RMT        false
+
+#endif
@@ -0,0 +1,3 @@
+// Only used when there's no include/config.h, the native env forces
+// benchConfig.h in first either way
+#include "benchConfig.h"
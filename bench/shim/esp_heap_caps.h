@@ -0,0 +1,14 @@
+#ifndef __RGB_DINO_SHIM_ESP_HEAP_CAPS_H__
+#define __RGB_DINO_SHIM_ESP_HEAP_CAPS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The host heap isn't the device's, so these all report an empty heap
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+size_t heap_caps_get_total_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+
+#endif
@@ -0,0 +1,3 @@
+#ifndef __RGB_DINO_SHIM_ESP_LOG_H__
+#define __RGB_DINO_SHIM_ESP_LOG_H__
+#endif
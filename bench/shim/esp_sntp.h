@@ -0,0 +1,11 @@
+#ifndef __RGB_DINO_SHIM_ESP_SNTP_H__
+#define __RGB_DINO_SHIM_ESP_SNTP_H__
+
+#include <sys/time.h>
+
+// There's no network in the bench, so the clock never syncs
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef __RGB_DINO_SHIM_ESP_TIMER_H__
+#define __RGB_DINO_SHIM_ESP_TIMER_H__
+
+#include <stdint.h>
+
+// Microseconds on the fake clock, see shimAdvanceTime()
+int64_t esp_timer_get_time(void);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __RGB_DINO_SHIM_FREERTOS_H__
+#define __RGB_DINO_SHIM_FREERTOS_H__
+
+// Single threaded stand in for FreeRTOS, just enough for the bench to drive
+// the processing pipeline on the host. Nothing here ever blocks.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+typedef struct ShimTask *TaskHandle_t;
+typedef struct ShimQueue *QueueHandle_t;
+typedef struct ShimQueue *SemaphoreHandle_t;
+typedef struct ShimTimer *TimerHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct {
+    int owner;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux) (void)(mux)
+
+#define portMAX_DELAY (TickType_t)0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL pdFALSE
+
+#define configMAX_PRIORITIES 25
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define PRO_CPU_NUM 0
+#define APP_CPU_NUM 1
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef __RGB_DINO_SHIM_QUEUE_H__
+#define __RGB_DINO_SHIM_QUEUE_H__
+
+#include "freertos/FreeRTOS.h"
+
+// A full queue fails the send straight away instead of blocking
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#endif
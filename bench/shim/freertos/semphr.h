@@ -0,0 +1,10 @@
+#ifndef __RGB_DINO_SHIM_SEMPHR_H__
+#define __RGB_DINO_SHIM_SEMPHR_H__
+
+#include "freertos/FreeRTOS.h"
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __RGB_DINO_SHIM_TASK_H__
+#define __RGB_DINO_SHIM_TASK_H__
+
+#include "freertos/FreeRTOS.h"
+
+// Tasks are never started, the bench calls the per-action handlers itself
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t increment);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+// There's nobody to wait for, ulTaskNotifyTake() runs the bench's wait hook instead, see shim.h
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+
+#endif
@@ -0,0 +1,394 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_heap_caps.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <mqtt_client.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "shim.h"
+
+#define SHIM_MAX_TIMERS 8
+
+//==============================================================================
+// Clock
+
+static int64_t now = 0;
+
+int64_t shimNow(void)
+{
+    return now;
+}
+
+void shimAdvanceTime(int64_t us)
+{
+    now += us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return now;
+}
+
+unsigned long millis(void)
+{
+    return (unsigned long)(now / 1000);
+}
+
+unsigned long micros(void)
+{
+    return (unsigned long)now;
+}
+
+void delay(uint32_t ms)
+{
+    shimAdvanceTime((int64_t)ms * 1000);
+}
+
+long map(long x, long inMin, long inMax, long outMin, long outMax)
+{
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 0;
+}
+
+size_t heap_caps_get_total_size(uint32_t caps)
+{
+    return 0;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return 0;
+}
+
+void configTime(long gmtOffset, int daylightOffset, const char *server) {}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) {}
+
+//==============================================================================
+// Serial
+
+HardwareSerial Serial;
+
+int HardwareSerial::printf(const char *format, ...)
+{
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vprintf(format, args);
+    va_end(args);
+
+    return length;
+}
+
+//==============================================================================
+// Tasks
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    if (handle) {
+        *handle = NULL;
+    }
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {}
+
+void vTaskDelay(TickType_t ticks)
+{
+    shimAdvanceTime((int64_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+void vTaskDelayUntil(TickType_t *previousWake, TickType_t increment)
+{
+    *previousWake += increment;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(now / (portTICK_PERIOD_MS * 1000));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return NULL;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return 0;
+}
+
+static void (*waitHook)(void) = NULL;
+
+void shimSetWaitHook(void (*hook)(void))
+{
+    waitHook = hook;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks)
+{
+    if (waitHook) {
+        waitHook();
+    }
+
+    return 1;
+}
+
+//==============================================================================
+// Queues
+
+struct ShimQueue
+{
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    QueueHandle_t queue = (QueueHandle_t)calloc(1, sizeof(ShimQueue));
+
+    if (queue) {
+        queue->items = (uint8_t *)calloc(length ? length : 1, itemSize ? itemSize : 1);
+        queue->length = length;
+        queue->itemSize = itemSize;
+    }
+
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    if (queue->count >= queue->length) {
+        return errQUEUE_FULL;
+    }
+
+    memcpy(&queue->items[((queue->head + queue->count) % queue->length) * queue->itemSize], item, queue->itemSize);
+    queue->count++;
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item)
+{
+    queue->head = 0;
+    queue->count = 0;
+
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    if (!queue->count) {
+        return pdFALSE;
+    }
+
+    if (item) {
+        memcpy(item, &queue->items[queue->head * queue->itemSize], queue->itemSize);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return queue->count;
+}
+
+// Nothing else runs, so a mutex (a queue of one empty item) can always be taken
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return pdTRUE;
+}
+
+//==============================================================================
+// Timers
+
+struct ShimTimer
+{
+    TimerCallbackFunction_t callback;
+    TickType_t period;
+    TickType_t expiry;
+    bool autoReload;
+    bool active;
+};
+
+static ShimTimer timers[SHIM_MAX_TIMERS];
+static uint8_t timerCount = 0;
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload, void *id, TimerCallbackFunction_t callback)
+{
+    if (timerCount >= SHIM_MAX_TIMERS) {
+        return NULL;
+    }
+
+    TimerHandle_t timer = &timers[timerCount++];
+    timer->callback = callback;
+    timer->period = period;
+    timer->autoReload = autoReload;
+    timer->active = false;
+
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+    timer->expiry = xTaskGetTickCount() + timer->period;
+    timer->active = true;
+
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+    timer->active = false;
+
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait)
+{
+    return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+    timer->period = period;
+
+    return xTimerStart(timer, wait);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+    return timer->active;
+}
+
+void shimRunTimers(void)
+{
+    TickType_t ticks = xTaskGetTickCount();
+    uint8_t i;
+
+    for (i = 0; i < timerCount; i++) {
+        if (timers[i].active && (int32_t)(ticks - timers[i].expiry) >= 0) {
+            timers[i].active = timers[i].autoReload;
+            timers[i].expiry = ticks + timers[i].period;
+            timers[i].callback(&timers[i]);
+        }
+    }
+}
+
+//==============================================================================
+// Mqtt client
+
+static uint32_t publishCount = 0;
+static uint32_t publishBytes = 0;
+static void (*publishHook)(const char *topic, const char *data, int length) = NULL;
+
+uint32_t shimPublishCount(void)
+{
+    return publishCount;
+}
+
+uint32_t shimPublishBytes(void)
+{
+    return publishBytes;
+}
+
+void shimResetPublishes(void)
+{
+    publishCount = 0;
+    publishBytes = 0;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    return NULL;
+}
+
+int esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t handler, void *args)
+{
+    return 0;
+}
+
+int esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    return 0;
+}
+
+int esp_mqtt_client_reconnect(esp_mqtt_client_handle_t client)
+{
+    return 0;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    return 0;
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+    return 0;
+}
+
+void shimSetPublishHook(void (*hook)(const char *topic, const char *data, int length))
+{
+    publishHook = hook;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain)
+{
+    publishCount++;
+    publishBytes += len ? len : strlen(data);
+    if (publishHook) {
+        publishHook(topic, data, len ? len : strlen(data));
+    }
+
+    return (int)publishCount;
+}
+
+//==============================================================================
+// Preferences
+
+Preferences::Entry Preferences::entries[SHIM_PREFERENCES_KEYS];
+uint32_t Preferences::writes = 0;
@@ -0,0 +1,28 @@
+#ifndef __RGB_DINO_SHIM_H__
+#define __RGB_DINO_SHIM_H__
+
+#include <stdint.h>
+
+//==============================================================================
+// Bench controls for the host shims
+
+// The fake clock everything reads (esp_timer_get_time(), millis(), ticks)
+int64_t shimNow(void);
+void shimAdvanceTime(int64_t us);
+
+// Fires every timer that has expired on the fake clock
+void shimRunTimers(void);
+
+// Stands in for whichever task a blocked sender is waiting on, without it a
+// wait would spin forever
+void shimSetWaitHook(void (*hook)(void));
+
+// What the firmware tried to send
+uint32_t shimPublishCount(void);
+uint32_t shimPublishBytes(void);
+void shimResetPublishes(void);
+
+// Sees every publish as it goes out, for checking what was sent
+void shimSetPublishHook(void (*hook)(const char *topic, const char *data, int length));
+
+#endif
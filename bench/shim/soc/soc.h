@@ -0,0 +1,3 @@
+#ifndef __RGB_DINO_SHIM_SOC_H__
+#define __RGB_DINO_SHIM_SOC_H__
+#endif
@@ -0,0 +1,73 @@
+#ifndef __RGB_DINO_ACTION_QUEUE_H__
+#define __RGB_DINO_ACTION_QUEUE_H__
+
+#include "config.h"
+#include <stdint.h>
+#include "mqttEventProcessing.h"
+
+/**
+ * What the mqtt task does when the action queue it's sending to is full. It
+ * must never block for long, a stalled mqtt task misses its keepalives and
+ * the broker drops the connection.
+ *
+ *   drop newest: the new action is thrown away
+ *   drop oldest: the action that has waited longest makes room for it
+ *   coalesce:    queued actions of the same type (format and segment) are
+ *                replaced by the new one, if there aren't any the oldest is
+ *                dropped
+ *   wait:        waits up to ACTION_QUEUE_WAIT_MS for room, then drops the
+ *                new action
+ *
+ * Every outcome is counted per queue in the metrics. Only mqtt actions ever
+ * go through the queues, so a policy can only drop what came off the network.
+ */
+typedef enum ActionQueuePolicy : uint8_t {
+    QUEUE_POLICY_DROP_NEWEST = 0,
+    QUEUE_POLICY_DROP_OLDEST = 1,
+    QUEUE_POLICY_COALESCE = 2,
+    QUEUE_POLICY_WAIT = 3,
+} ActionQueuePolicy_t;
+
+#ifndef SHORT_ACTION_QUEUE_POLICY
+#define SHORT_ACTION_QUEUE_POLICY QUEUE_POLICY_COALESCE
+#endif
+
+#ifndef LONG_ACTION_QUEUE_POLICY
+#if COALESCE_SET_COLOR
+#define LONG_ACTION_QUEUE_POLICY QUEUE_POLICY_COALESCE
+#else
+#define LONG_ACTION_QUEUE_POLICY QUEUE_POLICY_WAIT
+#endif
+#endif
+
+#ifndef ACTION_QUEUE_WAIT_MS
+#define ACTION_QUEUE_WAIT_MS 20
+#endif
+
+/**
+ * Work the timers and the render task hand to the short task. These can't
+ * be dropped, so instead of queueing an action they raise a bit and wake the
+ * short task, which takes every raised bit after each action it runs. A bit
+ * that's raised again before it's taken is only handled once.
+ */
+typedef enum ShortSignal : uint32_t {
+    SIGNAL_FLUSH_STATUS = 1 << 0,    // The status publish rate limit is up
+    SIGNAL_PUBLISH_METRICS = 1 << 1, // The metrics interval is up
+    SIGNAL_STORE_STATE = 1 << 2,     // Commands have settled and can be written to NVS
+    SIGNAL_RECONNECT_MQTT = 1 << 3,  // The reconnect backoff is up
+    SIGNAL_PUBLISH_STATUS = 1 << 8,  // A segment's status is due, one bit per segment from here
+} ShortSignal_t;
+
+#define SIGNAL_PUBLISH_STATUS_FOR(segment) ((uint32_t)SIGNAL_PUBLISH_STATUS << (segment))
+
+// Mqtt task. Returns false when the action was dropped.
+bool queueShortAction(const SubscriptionAction_t *action);
+bool queueLongAction(const SubscriptionAction_t *action);
+
+// Any task, never blocks and never fails
+void signalShortTask(uint32_t signals);
+
+// Short task only, returns (and clears) every signal raised since the last call
+uint32_t takeShortSignals(void);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef __RGB_DINO_BENCHMARK_H__
+#define __RGB_DINO_BENCHMARK_H__
+
+#include "config.h"
+#include <stdint.h>
+
+/**
+ * On device benchmark (enabled with APP_BENCHMARK in config.h)
+ *
+ * Publishing to SUB_BENCHMARK makes the short task run a sweep and publish
+ * the results as json to PUB_BENCHMARK. For every pixel count from
+ * NEO_PIXEL_COUNT, doubling up to BENCHMARK_MAX_PIXELS, it times show() on
+ * its own and one frame of each effect. It also times parsing a SET_COLOR
+ * payload and serializing a status, all in microseconds.
+ *
+ * The sweep drives a scratch strip on NEO_PIXEL_PIN while the render task
+ * has segment 0 paused, so that ring shows garbage until it's done. Its
+ * effects and commands carry on unseen and show up again afterwards, and the
+ * other segments aren't touched.
+ */
+#ifndef APP_BENCHMARK
+#define APP_BENCHMARK false
+#endif
+
+#ifndef BENCHMARK_MAX_PIXELS
+#define BENCHMARK_MAX_PIXELS 256
+#endif
+
+#define BENCHMARK_ITERATIONS 16      // Shows and frames timed per pixel count
+#define BENCHMARK_JSON_ITERATIONS 100
+
+#if defined(APP_BENCHMARK) && APP_BENCHMARK
+// Short task only
+void runBenchmark(void);
+#endif
+
+#endif
@@ -7,10 +7,18 @@
 #define DEBUG          false // This will trigger other library's debug functionality
 #define APP_DEBUG      false
 #define APP_MQTT_DEBUG false
+#define APP_LATENCY_DEBUG false // Log the time (us) from an action being queued to it being handled
+#define APP_TRACE      false // Binary hot path tracing, dumped over mqtt (needs SUB_TRACE_DUMP and PUB_TRACE)
+#define APP_BENCHMARK  false // On device benchmark sweep, run over mqtt (needs SUB_BENCHMARK and PUB_BENCHMARK)
+#define APP_MEMORY_AUDIT false // Stack, heap and static buffer report, run over mqtt (needs SUB_MEMORY_AUDIT and PUB_MEMORY_AUDIT)
 
 // Wifi
 #define WLAN_SSID      ""
 #define WLAN_PASS      ""
+// #define WLAN_STATIC_IP "192.168.1.50" // Skip DHCP, needs WLAN_GATEWAY and WLAN_SUBNET
+// #define WLAN_GATEWAY   "192.168.1.1"
+// #define WLAN_SUBNET    "255.255.255.0"
+// #define WLAN_DNS       "192.168.1.1"  // Defaults to the gateway
 
 // MQTT
 // 8883 === ssl
@@ -18,20 +26,89 @@
 #define MQTT_URI       "mqtt://0.0.0.0:1883"
 #define MQTT_USER      ""
 #define MQTT_PASS      ""
+// #define MQTT_KEEPALIVE 120             // Seconds between pings on an idle connection
+// #define MQTT_NETWORK_TIMEOUT_MS 10000  // Longest a connect, read or write can take
+// #define MQTT_RECONNECT_MIN_MS 2000     // First reconnect backoff, doubles on every failed attempt
+// #define MQTT_RECONNECT_MAX_MS 120000   // Longest reconnect backoff
+// #define MQTT_PERSISTENT_SESSION false  // Keep the broker side session, skips resubscribing when it's still there
 
 // Subscription Topics
 #define SUB_GET_COLOR  ""
 #define SUB_SET_COLOR  ""
+// #define SUB_SET_BRIGHTNESS "" // {"brightness": 0 - 255}
+// #define SUB_SET_EFFECT ""     // Effect descriptor, see effectProgram.h
 
 // Publish Topics
 #define PUB_GET_COLOR  ""
 
+// Trace Topics (only used with APP_TRACE)
+// #define SUB_TRACE_DUMP ""
+// #define PUB_TRACE      ""
+
+// Benchmark Topics (only used with APP_BENCHMARK)
+// #define SUB_BENCHMARK  ""
+// #define PUB_BENCHMARK  ""
+// #define BENCHMARK_MAX_PIXELS 256
+
+// Memory Audit Topics (only used with APP_MEMORY_AUDIT)
+// #define SUB_MEMORY_AUDIT ""
+// #define PUB_MEMORY_AUDIT ""
+
+// Metrics Topic (optional, runtime metrics published as json every METRICS_INTERVAL_MS)
+// #define PUB_METRICS    ""
+// #define METRICS_INTERVAL_MS 30000
+
+// Binary Topics (optional, skips json for fleet controllers)
+// #define SUB_GET_COLOR_BIN ""
+// #define SUB_SET_COLOR_BIN ""
+// #define PUB_GET_COLOR_BIN ""
+
+// Streaming Topic (optional, raw NEO_PIXEL_COUNT * 3 byte frames of r,g,b per pixel)
+// #define SUB_STREAM     ""
+// #define STREAM_FRAME_CORRECTION false // Put frames through gamma and brightness like colors
+
+// Group Topics (optional, every dino in a group answers on <group>/<topic>, see mqttRouter.h)
+// #define MQTT_GROUP_TOPICS "rgb/all" // Comma separated, e.g. "rgb/all", "rgb/living_room"
+// #define SCENE_MAX_DELAY_MS 60000    // Furthest ahead (ms) a SET_COLOR "at" can start
+// #define SNTP_SERVER "pool.ntp.org"  // Where the clock for "at" comes from
+
+// Processing
+#define COALESCE_SET_COLOR true // Latest SET_COLOR wins, instead of playing every queued fade
+// #define SHORT_ACTION_QUEUE_POLICY QUEUE_POLICY_COALESCE // What to do when a queue is full, see actionQueue.h
+// #define LONG_ACTION_QUEUE_POLICY  QUEUE_POLICY_COALESCE // Defaults to QUEUE_POLICY_WAIT without COALESCE_SET_COLOR
+// #define ACTION_QUEUE_WAIT_MS 20 // Longest the mqtt task waits on a full queue with QUEUE_POLICY_WAIT
+// #define RENDER_CHANNEL_LENGTH 8 // Commands each task can have waiting for the render task, a power of 2
+// #define SHORT_ACTION_QUEUE_LENGTH 5 // Actions each queue holds
+// #define LONG_ACTION_QUEUE_LENGTH  5 // Defaults to SEGMENT_COUNT with COALESCE_SET_COLOR
+#define STATUS_PUBLISH_MAX_RATE 5 // Status publishes per second, at most
+#define STATUS_PUBLISH_RETAIN false // Publish the status retained
+// #define STATE_STORE_DELAY_MS 2000 // Quiet time (ms) before the last color is saved for the next boot
+// #define STATE_STORE_MAX_DELAY_MS 60000 // Longest (ms) a save can be put off while the color keeps changing
+
 // Pins
 #define NEO_PIXEL_PIN   14
 #define NEO_PIXEL_COUNT 12
 
-// Mqtt overrides
-// #define MQTT_CORE_SELECTION_ENABLED
-// #define MQTT_TASK_CORE PRO_CPU_NUM
+// Segments, more strips on their own pins and topics (<topic>/1, ...), see segment.h
+// #define SEGMENT_COUNT   2
+// #define SEGMENT_1_PIN   15
+// #define SEGMENT_1_COUNT 30
+
+// Neo pixel output
+#define NEO_PIXEL_GAMMA      true // Gamma correct colors on the way out
+#define NEO_PIXEL_BRIGHTNESS 255  // Global brightness (0 - 255)
+#define NEO_PIXEL_RMT        true // Send frames out through the RMT peripheral without blocking
+// #define NEO_PIXEL_RMT_CHANNEL RMT_CHANNEL_7 // Segment n gets the channel n below this one
+
+// Task stacks (bytes) and mqtt buffers, APP_MEMORY_AUDIT shows what they use
+// #define SHORT_TASK_STACK  2048
+// #define LONG_TASK_STACK   2048
+// #define RENDER_TASK_STACK 2048
+// #define MQTT_TASK_STACK   6144
+// #define MQTT_BUFFER_SIZE  2048 // Largest mqtt message read in one go, has to fit a SUB_STREAM frame
+// #define MQTT_OUT_BUFFER_SIZE 0 // Outgoing, 0 is the same as MQTT_BUFFER_SIZE
+
+// Task cores and priorities are set in globals.h. The mqtt task's core is
+// an sdkconfig option of esp-mqtt (CONFIG_MQTT_TASK_CORE_SELECTION_ENABLED).
 
 #endif
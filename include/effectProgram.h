@@ -0,0 +1,92 @@
+#ifndef __RGB_DINO_EFFECT_PROGRAM_H__
+#define __RGB_DINO_EFFECT_PROGRAM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "led.h"
+
+/**
+ * Effect descriptors (optional, enabled by defining SUB_SET_EFFECT in config.h)
+ *
+ * {
+ *     "palette": ["000000", "0040ff"],           // Up to EFFECT_MAX_PALETTE hex colors
+ *     "keyframes": [[0, 0], [1000, 1], [2000, 0]], // [ms, palette index], the first at 0
+ *     "mode": "smooth",                           // step, linear or smooth (default linear)
+ *     "speed": 100,                               // 10 - 1000 percent, 100 plays it as written
+ *     "spread": 0,                                // 0 - 255, how much of a loop is spread around the ring
+ *     "loops": 0                                  // 0 loops forever
+ * }
+ *
+ * A descriptor is parsed once into an EffectProgram_t. The palette is resolved
+ * into the keyframes and every division is worked out up front, so the render
+ * task samples it without allocating anything.
+ *
+ * One loop lasts until the last keyframe, then starts over from the first, so
+ * a seamless loop ends on the color it started with. A spread of 0 keeps the
+ * whole ring in step (breathing, palette cycles), a bigger spread offsets each
+ * pixel further into the loop (chases).
+ *
+ * A descriptor with a "layer" plays on top of whatever the ring is showing
+ * instead of replacing it, until its loops are done or it's cleared:
+ *
+ *     "layer": 1,        // 1 - EFFECT_MAX_LAYERS, higher layers go on top (0 is the ring itself)
+ *     "blend": "add",    // normal, add, multiply or screen (default normal)
+ *     "opacity": 255,    // 0 - 255, how much of the blended color shows
+ *     "clear": true      // Takes the layer off, nothing else is needed
+ *
+ * An add or screen layer shows nothing where it's black and a multiply layer
+ * nothing where it's white, so a notification flash is an add layer going
+ * from black to a color and back, and a brightness envelope a multiply layer
+ * of grays. Layers aren't saved, a reboot comes back without them.
+ */
+#define EFFECT_MAX_PALETTE 16
+#define EFFECT_MAX_KEYFRAMES 16
+#define EFFECT_JSON_LEN 768 // Longest descriptor accepted
+#define EFFECT_MAX_LAYERS 2 // Layers a ring can show on top of itself
+
+typedef enum EffectInterpolation : uint8_t {
+    INTERPOLATE_STEP = 0,
+    INTERPOLATE_LINEAR = 1,
+    INTERPOLATE_SMOOTH = 2,
+} EffectInterpolation_t;
+
+// How a layer's color goes onto the one underneath
+typedef enum EffectBlend : uint8_t {
+    BLEND_NORMAL = 0,   // The layer's color
+    BLEND_ADD = 1,      // Both added, clipped at 255
+    BLEND_MULTIPLY = 2, // Underneath scaled by the layer, white leaves it alone
+    BLEND_SCREEN = 3,   // The inverse of multiplying the inverses, black leaves it alone
+} EffectBlend_t;
+
+typedef struct EffectLayer {
+    uint8_t layer; // 0 is the ring itself, the other fields only apply above it
+    EffectBlend_t blend;
+    uint8_t opacity;
+    bool clear;
+} EffectLayer_t;
+
+typedef struct EffectKeyframe {
+    uint16_t at; // ms from the start of the loop
+    RGB_t color;
+} EffectKeyframe_t;
+
+typedef struct EffectProgram {
+    EffectKeyframe_t keyframes[EFFECT_MAX_KEYFRAMES];
+    uint32_t reciprocals[EFFECT_MAX_KEYFRAMES]; // 1 / length of the segment after each keyframe, 0.32 fixed point
+    uint32_t speedScale;                        // Effect ms per us, 0.32 fixed point
+    uint32_t loopTime;                          // us one loop takes at this speed
+    uint16_t duration;                          // ms, the last keyframe's time
+    uint16_t loops;
+    uint8_t keyframeCount;
+    uint8_t spread;
+    EffectInterpolation_t interpolation;
+} EffectProgram_t;
+
+// Returns false, leaving the program untouched, when the descriptor isn't valid.
+// A descriptor that clears a layer leaves the program untouched as well.
+bool parseEffectProgram(EffectProgram_t *program, EffectLayer_t *layer, const char *json, size_t length);
+
+// The color at `at` ms into the loop, at must be less than the duration
+void sampleEffectProgram(const EffectProgram_t *program, uint16_t at, RGB_t *color);
+
+#endif
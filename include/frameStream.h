@@ -0,0 +1,39 @@
+#ifndef __RGB_DINO_FRAME_STREAM_H__
+#define __RGB_DINO_FRAME_STREAM_H__
+
+#include "config.h"
+#include <stdint.h>
+#include "segment.h"
+
+/**
+ * Per-pixel frame streaming (optional, enabled by defining SUB_STREAM in config.h)
+ *
+ * A frame is 3 bytes of raw [r, g, b] for every pixel in the segment. Frames
+ * go straight from the mqtt task to the render task, they never touch the
+ * action queues. Only the newest frame of each segment is kept, if the render
+ * task hasn't picked up the previous one yet it's dropped.
+ *
+ * The bytes are written to the strip as they are, without gamma correction or
+ * brightness, unless STREAM_FRAME_CORRECTION is set. Raw frames stay raw until
+ * the segment gets a color or an effect again.
+ *
+ * A frame has to arrive in a single mqtt event, so MQTT_BUFFER_SIZE needs to
+ * fit the longest segment's frame plus its topic. This is checked at compile
+ * time, frames of the wrong length are rejected.
+ */
+#ifndef STREAM_FRAME_CORRECTION
+#define STREAM_FRAME_CORRECTION false
+#endif
+
+#define STREAM_FRAME_LEN(segment) (segmentPixelCounts[segment] * 3)
+#define STREAM_FRAME_MAX_LEN (maxSegmentPixels() * 3)
+
+// Producer (mqtt task)
+bool frameStreamWrite(uint8_t segment, const uint8_t *data, int length);
+
+// Consumer (render task), returns NULL when there's no new frame
+const uint8_t *frameStreamRead(uint8_t segment);
+
+uint32_t frameStreamDropped(void);
+
+#endif
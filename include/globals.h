@@ -10,6 +10,88 @@
 #include <HardwareSerial.h>
 #include <mqtt_client.h>
 #include "neoPixelRing.h"
+#include "segment.h"
+
+//==============================================================================
+// Defaults
+
+#ifndef NEO_PIXEL_GAMMA
+#define NEO_PIXEL_GAMMA true
+#endif
+
+#ifndef NEO_PIXEL_BRIGHTNESS
+#define NEO_PIXEL_BRIGHTNESS 255
+#endif
+
+#ifndef NEO_PIXEL_RMT
+#define NEO_PIXEL_RMT true
+#endif
+
+//==============================================================================
+// Pipeline
+
+// WiFi and lwIP run on PRO_CPU, so everything that talks to the network (the
+// short task publishes, the long task only hands commands to the ring) joins
+// them there. The render task gets APP_CPU to itself.
+//
+// The mqtt task's core is picked by the prebuilt esp-mqtt
+// (CONFIG_MQTT_TASK_CORE_SELECTION_ENABLED in sdkconfig), so the render
+// task's priority is kept above it in case it lands on APP_CPU.
+#define NETWORK_CPU PRO_CPU_NUM
+#define RENDER_CPU APP_CPU_NUM
+
+#define MQTT_TASK_PRIORITY 5
+#define SHORT_TASK_PRIORITY 2
+#define LONG_TASK_PRIORITY 1
+#define RENDER_TASK_PRIORITY (MQTT_TASK_PRIORITY + 1)
+
+// Stack sizes are in bytes (ESP32 FreeRTOS counts stacks in bytes, not words).
+// Build with APP_MEMORY_AUDIT to see how much of each a stress run touches.
+#ifndef SHORT_TASK_STACK
+#define SHORT_TASK_STACK 2048
+#endif
+
+#ifndef LONG_TASK_STACK
+#define LONG_TASK_STACK 2048
+#endif
+
+#ifndef RENDER_TASK_STACK
+#define RENDER_TASK_STACK 2048
+#endif
+
+#ifndef MQTT_TASK_STACK
+#define MQTT_TASK_STACK 6144
+#endif
+
+// Largest mqtt message that's read in one go, longer ones arrive in chunks
+#ifndef MQTT_BUFFER_SIZE
+#define MQTT_BUFFER_SIZE 2048
+#endif
+
+// Outgoing messages, 0 uses MQTT_BUFFER_SIZE
+#ifndef MQTT_OUT_BUFFER_SIZE
+#define MQTT_OUT_BUFFER_SIZE 0
+#endif
+
+//==============================================================================
+// Mqtt connection
+
+// Seconds. Each ping keeps a (TLS) connection alive that would otherwise cost
+// a full handshake to bring back, so it's only as short as the broker and
+// any NAT in between need.
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE 120
+#endif
+
+#ifndef MQTT_NETWORK_TIMEOUT_MS
+#define MQTT_NETWORK_TIMEOUT_MS 10000
+#endif
+
+// Asks the broker to keep the session (subscriptions) across reconnects, so
+// a reconnect that finds it still there doesn't resubscribe every topic
+#ifndef MQTT_PERSISTENT_SESSION
+#define MQTT_PERSISTENT_SESSION false
+#endif
 
 //==============================================================================
 // Macros
@@ -26,14 +108,14 @@
 
 // Mqtt client
 extern esp_mqtt_client_handle_t mqttClient;
-// Adafruit NeoPixels
-extern NeoPixelRing ring;
+// Adafruit NeoPixels, see segment.h
+extern Segment_t segments[SEGMENT_COUNT];
 // freertos
 extern TaskHandle_t mqttMTaskHandle;
 extern TaskHandle_t processShortTaskHandle;
 extern TaskHandle_t processLongTaskHandle;
+extern TaskHandle_t renderTaskHandle;
 extern QueueHandle_t shortActionQueue;
 extern QueueHandle_t longActionQueue;
-extern SemaphoreHandle_t ringMutex;
 
 #endif
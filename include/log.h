@@ -16,6 +16,7 @@ void appLog(const __FlashStringHelper *message);
 void appLog(DeserializationError *error);
 void appLog(esp_mqtt_event_handle_t event);
 void appLog(SubscriptionAction_t *action);
+void appLogLatency(SubscriptionAction_t *action);
 
 #define APP_LOG(data) appLog(data)
 #define APP_LOGF(format, ...) Serial.printf(format, ##__VA_ARGS__)
@@ -32,4 +33,10 @@ void appLog(SubscriptionAction_t *action);
 #define MQTT_EVENT_LOGF(format, ...)
 #endif
 
+#if defined(APP_DEBUG) && APP_DEBUG && defined(APP_LATENCY_DEBUG) && APP_LATENCY_DEBUG
+#define ACTION_LATENCY_LOG(action) appLogLatency(action)
+#else
+#define ACTION_LATENCY_LOG(action)
+#endif
+
 #endif
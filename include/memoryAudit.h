@@ -0,0 +1,58 @@
+#ifndef __RGB_DINO_MEMORY_AUDIT_H__
+#define __RGB_DINO_MEMORY_AUDIT_H__
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Memory audit (enabled with APP_MEMORY_AUDIT in config.h)
+ *
+ * For sizing the task stacks, queues and mqtt buffers in globals.h and
+ * mqttEventProcessing.h. Publishing to SUB_MEMORY_AUDIT after a stress run
+ * makes the short task publish a json report to PUB_MEMORY_AUDIT:
+ *
+ *  - "stack", per task: the configured size and the bytes never touched
+ *  - "heap", free, lowest free and largest free block right now
+ *  - "setup", heap each stage of setup() took (AUDIT_HEAP())
+ *  - "static", bytes of static buffers per subsystem (AUDIT_STATIC())
+ *  - "queues", per queue: length, item size and the deepest it has been
+ *
+ * Without APP_MEMORY_AUDIT both macros compile to nothing.
+ */
+#ifndef APP_MEMORY_AUDIT
+#define APP_MEMORY_AUDIT false
+#endif
+
+#define MEMORY_AUDIT_MAX_STAGES 8
+
+#if defined(APP_MEMORY_AUDIT) && APP_MEMORY_AUDIT
+// One per static buffer, links itself into the report before setup() runs
+class MemoryAuditStatic {
+   public:
+    MemoryAuditStatic(const char *subsystem, size_t size);
+
+    const char *subsystem;
+    size_t size;
+    MemoryAuditStatic *next;
+};
+
+// setup() only, the heap taken since the previous stage is put down to this one
+void auditHeapStage(const char *stage);
+
+// Short task only
+void publishMemoryAudit(void);
+
+#define AUDIT_CONCAT_(a, b) a##b
+#define AUDIT_CONCAT(a, b) AUDIT_CONCAT_(a, b)
+
+// At file scope, next to the buffer
+#define AUDIT_STATIC(subsystem, object) \
+    static MemoryAuditStatic AUDIT_CONCAT(memoryAudit, __LINE__)(subsystem, sizeof(object))
+#define AUDIT_HEAP(stage) auditHeapStage(stage)
+#else
+#define AUDIT_STATIC(subsystem, object)
+#define AUDIT_HEAP(stage)
+#endif
+
+#endif
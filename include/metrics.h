@@ -0,0 +1,67 @@
+#ifndef __RGB_DINO_METRICS_H__
+#define __RGB_DINO_METRICS_H__
+
+#include "config.h"
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/**
+ * Runtime metrics, published as json to PUB_METRICS (when it's defined) every
+ * METRICS_INTERVAL_MS. Recording is a handful of relaxed atomic adds, so it's
+ * always on and safe to call from any task.
+ *
+ * Latency histograms are log2 buckets: bucket 0 is < 128us, bucket n is
+ * < 128us << n, and the last bucket holds everything slower.
+ */
+#ifndef METRICS_INTERVAL_MS
+#define METRICS_INTERVAL_MS 30000
+#endif
+
+#define METRICS_LATENCY_BUCKETS 12
+#define METRICS_LATENCY_BASE_SHIFT 7 // 128us
+
+typedef enum MetricsCounter : uint8_t {
+    METRIC_REJECTED = 0,  // Malformed or oversized payloads
+    METRIC_COALESCED = 1, // Commands replaced by a newer one before they ran
+    METRIC_DROPPED = 2,   // Actions that didn't fit in their queue
+    METRIC_NVS_WRITES = 3, // State store writes to flash
+    METRIC_RENDER_WAITS = 4, // Render commands that found their channel full and waited for room
+    METRIC_COUNTER_COUNT,
+} MetricsCounter_t;
+
+typedef enum MetricsQueue : uint8_t {
+    METRIC_QUEUE_SHORT = 0,
+    METRIC_QUEUE_LONG = 1,
+    METRIC_QUEUE_COUNT,
+} MetricsQueue_t;
+
+// What happened to a send that found its queue full, see actionQueue.h
+typedef enum MetricsOverflow : uint8_t {
+    METRIC_OVERFLOW_DROPPED_NEWEST = 0,
+    METRIC_OVERFLOW_DROPPED_OLDEST = 1,
+    METRIC_OVERFLOW_COALESCED = 2,
+    METRIC_OVERFLOW_WAITED = 3,
+    METRIC_OVERFLOW_COUNT,
+} MetricsOverflow_t;
+
+bool initMetrics(void);
+
+// Recording, any task
+void metricsCount(MetricsCounter_t counter);
+void metricsQueueDepth(MetricsQueue_t queue, uint32_t depth);
+void metricsQueueOverflow(MetricsQueue_t queue, MetricsOverflow_t overflow);
+void metricsQueueLatency(uint32_t enqueuedAt);
+void metricsCommandStarted(uint32_t enqueuedAt);
+void metricsCommandShown(uint32_t enqueuedAt);
+void metricsFrameRendered(uint32_t frameTime, bool shown);
+void metricsSetMqttTask(TaskHandle_t task);
+
+// Reading, any task
+uint32_t metricsQueueHighWater(MetricsQueue_t queue);
+TaskHandle_t metricsMqttTask(void); // NULL until the client first connects
+
+// Short task only
+void publishMetrics(void);
+
+#endif
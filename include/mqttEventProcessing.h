@@ -3,10 +3,88 @@
 
 #include "config.h"
 #include <mqtt_client.h>
+#include "led.h"
+#include "neoPixelRing.h"
+#include "segment.h"
 
 #define SUBSCRIPTIONDATALEN 100
 #define READ_SUBSCRIPTION_TIMEOUT 2000
 
+// When enabled a new SET_COLOR replaces the one still waiting in the long
+// queue (and retargets a fade in progress), so the latest color always wins.
+#ifndef COALESCE_SET_COLOR
+#define COALESCE_SET_COLOR true
+#endif
+
+// The "time" of a SET_COLOR counts in these, it used to be the number of 10ms
+// fade steps so keep the unit for the clients that already send it
+#define FADE_TIME_UNIT_MS 10
+
+#ifndef SHORT_ACTION_QUEUE_LENGTH
+#define SHORT_ACTION_QUEUE_LENGTH 5
+#endif
+
+#ifndef LONG_ACTION_QUEUE_LENGTH
+#if COALESCE_SET_COLOR
+#define LONG_ACTION_QUEUE_LENGTH SEGMENT_COUNT // The latest SET_COLOR for a segment replaces its waiting one, see actionQueue.h
+#else
+#define LONG_ACTION_QUEUE_LENGTH 5
+#endif
+#endif
+
+// {"r": 255, "g": 255, "b": 255, "time": 65535, "effect": "rainbow_cycle",
+// "at": 1700000000000}, plus room for the strings since the payload is parsed
+// straight out of the (read only) mqtt buffer
+#define SET_COLOR_JSON_CAPACITY (JSON_OBJECT_SIZE(6) + 48)
+#define SET_BRIGHTNESS_JSON_CAPACITY (JSON_OBJECT_SIZE(1) + 16)
+
+// Furthest ahead a scene can be scheduled, see ColorCommand_t
+#ifndef SCENE_MAX_DELAY_MS
+#define SCENE_MAX_DELAY_MS 60000
+#endif
+
+/**
+ * Sequences, a SET_COLOR payload that's a list of steps instead of one color
+ *
+ * json:   [{"r": 255, "g": 0, "b": 0, "time": 100, "hold": 200}, {"b": 255, "time": 100}]
+ * binary: [r, g, b, time >> 8, time & 0xff, effect, hold >> 8, hold & 0xff] per step
+ *
+ * Each step is a SET_COLOR (without "at"), followed by "hold": how long it
+ * holds once its effect is done, in FADE_TIME_UNIT_MS units. The render task
+ * plays the steps back to back, so one message sets a whole scene with no
+ * broker round trip between the steps. The status goes out once the last
+ * step is done, and that's the color that's stored for the next boot.
+ *
+ * Like SUB_SET_EFFECT a sequence is too big for an action, so it's handled
+ * on the mqtt task and goes ahead of any SET_COLOR still waiting in the long
+ * queue. Any later SET_COLOR, effect or stream frame stops it.
+ */
+#define COLOR_SEQUENCE_MAX_STEPS 16
+#define COLOR_SEQUENCE_JSON_LEN 1024 // Longest json sequence accepted
+#define COLOR_SEQUENCE_JSON_CAPACITY (JSON_ARRAY_SIZE(COLOR_SEQUENCE_MAX_STEPS) \
+    + COLOR_SEQUENCE_MAX_STEPS * (JSON_OBJECT_SIZE(6) + 48))
+#define BINARY_COLOR_STEP_LEN 8
+
+/**
+ * Binary payloads (optional, enabled by defining the *_BIN topics in config.h)
+ *
+ * set color: [r, g, b], [r, g, b, time >> 8, time & 0xff] or
+ *            [r, g, b, time >> 8, time & 0xff, effect]
+ * status:    [r, g, b]
+ *
+ * effect is a RingEffect_t, see SET_COLOR below for what time means for each.
+ */
+#if defined(SUB_GET_COLOR_BIN) || defined(SUB_SET_COLOR_BIN)
+#define BINARY_TOPICS_ENABLED
+#ifndef PUB_GET_COLOR_BIN
+#error "PUB_GET_COLOR_BIN must be defined to use the binary topics"
+#endif
+#endif
+
+#define BINARY_COLOR_LEN 3
+#define BINARY_COLOR_TIME_LEN 5
+#define BINARY_COLOR_EFFECT_LEN 6
+
 typedef void (*SubscribeCallbackBufferType)(char *str, uint16_t len);
 
 typedef enum MqttQos {
@@ -15,27 +93,84 @@ typedef enum MqttQos {
     QOS_EXACTLY_ONCE = 2,
 } MqttQos_t;
 
-typedef enum SubsctiptionActionType {
+typedef enum SubsctiptionActionType : uint8_t {
     UNKNOWN = 0,
     GET_COLOR = 1,
     SET_COLOR = 2,
+    STREAM_FRAME = 3, // Handled on the mqtt task, never queued
+    SET_BRIGHTNESS = 4,
+    DUMP_TRACE = 8,
+    RUN_BENCHMARK = 9,
+    LOAD_EFFECT = 10, // Handled on the mqtt task, never queued
+    DUMP_MEMORY_AUDIT = 12,
 } SubsctiptionActionType_t;
 
+typedef enum PayloadFormat : uint8_t {
+    PAYLOAD_JSON = 0,
+    PAYLOAD_BINARY = 1,
+} PayloadFormat_t;
+
+/**
+ * A decoded SET_COLOR payload. "effect" is optional, without it a command with
+ * a time fades and one without is set straight away.
+ *
+ *   none, fade:             time is the fade length
+ *   wipe:                   one pixel per frame, time is ignored
+ *   rainbow, rainbow_cycle: time is how long each step of the wheel is held
+ *   program:                replays the last SUB_SET_EFFECT descriptor, time is ignored
+ *
+ * time is in FADE_TIME_UNIT_MS units.
+ *
+ * A JSON SET_COLOR can also carry "at", the wall clock time (ms since the
+ * epoch) it should start at. Sent to a group (see mqttRouter.h), every dino
+ * starts the same scene together, to within a millisecond or so of their
+ * SNTP clocks. A start that's already gone by, or that comes in before the
+ * clock has synced, starts straight away. One more than SCENE_MAX_DELAY_MS
+ * ahead is rejected.
+ */
+typedef struct ColorCommand {
+    RGB_t color;
+    uint8_t effect; // RingEffect_t
+    uint16_t time;
+} ColorCommand_t;
+
+typedef struct ColorStep {
+    ColorCommand_t command;
+    uint16_t hold; // FADE_TIME_UNIT_MS units, once the command's effect is done
+} ColorStep_t;
+
+typedef struct ColorSequence {
+    ColorStep_t steps[COLOR_SEQUENCE_MAX_STEPS];
+    uint8_t count;
+} ColorSequence_t;
+
+// Decoded on the mqtt task and only a few bytes, so the queues carry the
+// action itself and copy it in and out; there's no pool to hand out slots from
 typedef struct SubscriptionAction {
-    esp_mqtt_client_handle_t client;
+    uint32_t enqueuedAt; // esp_timer timestamp (us) of when the action was queued
+    uint32_t startAt;    // esp_timer timestamp (us) a SET_COLOR starts at, 0 is straight away
+    union {
+        ColorCommand_t command; // SET_COLOR
+        uint8_t brightness;     // SET_BRIGHTNESS
+    };
     SubsctiptionActionType_t type;
-    char data[SUBSCRIPTIONDATALEN];
-    uint16_t dataLength;
+    PayloadFormat_t format; // The format the action came in as, replies use the same one
+    uint8_t segment;        // Which segment it's for, see segment.h
 } SubscriptionAction_t;
 
+// Render task only (or setup(), before it starts), returns true when the
+// command started an effect
+bool applyColorCommand(NeoPixelRing *ring, const ColorCommand_t *command);
+
 // Subscribe callbacks
 void getColor(SubscriptionAction_t *action);
 void setColor(SubscriptionAction_t *action);
-
-// Publish functions
-void publishRgbStatus(void);
+void setBrightness(SubscriptionAction_t *action);
 
 // Task functions
+void processShortAction(SubscriptionAction_t *action);
+void processShortSignals(void);
+void processLongAction(SubscriptionAction_t *action);
 void processShortTask(void *parameter);
 void processLongTask(void *parameter);
 
@@ -0,0 +1,56 @@
+#ifndef __RGB_DINO_MQTT_ROUTER_H__
+#define __RGB_DINO_MQTT_ROUTER_H__
+
+#include "config.h"
+#include <stdint.h>
+#include "mqttEventProcessing.h"
+
+// Must be a power of two, and comfortably bigger than the number of topics
+#define MQTT_ROUTE_TABLE_SIZE 32
+
+/**
+ * Groups (optional, enabled by defining MQTT_GROUP_TOPICS in config.h)
+ *
+ * A comma separated list of topic prefixes the dino also answers on, e.g.
+ * "rgb/all", "rgb/living_room". Publishing to <group>/<topic>, where topic is
+ * one of the dino's own, reaches every dino in the group with a single
+ * message. Without a "/<n>" on the end it goes to every segment. Each group
+ * is a single <group>/# subscription.
+ */
+#if defined(MQTT_GROUP_TOPICS)
+#define MQTT_GROUPS_ENABLED
+#endif
+
+typedef enum ActionQueueClass : uint8_t {
+    QUEUE_INLINE = 0, // Handled right on the mqtt task
+    QUEUE_SHORT = 1,
+    QUEUE_LONG = 2,
+} ActionQueueClass_t;
+
+typedef struct MqttRoute {
+    const char *topic;
+    SubsctiptionActionType_t type;
+    PayloadFormat_t format;
+    ActionQueueClass_t queue;
+    bool segmented;       // Also routed as <topic>/<n> for the other segments, see segment.h
+    bool grouped;         // Also routed under each of MQTT_GROUP_TOPICS
+    uint16_t topicLength; // Filled in by initMqttRoutes()
+    uint32_t hash;        // Filled in by initMqttRoutes()
+} MqttRoute_t;
+
+// Builds the lookup table, call once before the mqtt client starts
+void initMqttRoutes(void);
+
+// Exact match on the topic, or on a segmented route's topic with "/<n>" on
+// the end, or either of those under a group. Returns NULL when the topic
+// isn't routed, otherwise `segment` is set to the segment it's for, or
+// SEGMENT_ALL.
+const MqttRoute_t *findMqttRoute(const char *topic, int topicLength, uint8_t *segment);
+
+uint8_t getMqttRouteCount(void);
+const MqttRoute_t *getMqttRoute(uint8_t index);
+
+uint8_t getMqttGroupCount(void);
+const char *getMqttGroup(uint8_t index);
+
+#endif
@@ -2,30 +2,136 @@
 #define __RGB_DINO_NEO_PIXEL_RING_H__
 
 #include <Adafruit_NeoPixel.h>
+#include "effectProgram.h"
 #include "led.h"
 
+typedef enum RingEffect {
+    EFFECT_NONE = 0,
+    EFFECT_FADE = 1,
+    EFFECT_WIPE = 2,
+    EFFECT_RAINBOW = 3,
+    EFFECT_RAINBOW_CYCLE = 4,
+    EFFECT_PROGRAM = 5,
+} RingEffect_t;
+
+#define RING_EFFECT_COUNT 6
+
+typedef struct RingLayer {
+    EffectProgram_t program;
+    int64_t programStart;
+    uint16_t loopsPlayed;
+    uint16_t at;  // ms into the loop, as of the last frame
+    RGB_t color;  // At `at`, for layers without a spread
+    EffectBlend_t blend;
+    uint16_t alpha; // Opacity, 0 - 256
+} RingLayer_t;
+
+// Sends a frame of raw pixel bytes (in the strip's own color order) out instead of neoPixel->show()
+typedef void (*PixelOutput_t)(void *context, const uint8_t *pixels, uint16_t length);
+
+/**
+ * The effect methods (fadeColor, wipeColor, rainbow, rainbowCycle) don't block,
+ * they only retarget the ring. The active effect is advanced one frame at a
+ * time by calling update() from the render task.
+ *
+ * Pixels are only written when their color changes, and show() is skipped for
+ * frames where nothing changed. getFramesShown()/getFramesSkipped() count both.
+ *
+ * Colors are kept as they were set. On the way out they go through one lookup
+ * table that folds in gamma correction and the global brightness. Streamed
+ * frames can skip the table, see showFrame().
+ *
+ * The color wheel is a precomputed table, and every pixel's offset around the
+ * ring is worked out in begin(), so a rainbow frame is a lookup and an add
+ * per pixel.
+ *
+ * runProgram() plays an EffectProgram_t (see effectProgram.h) the same way,
+ * a copy is kept so it can be replayed without being parsed again.
+ *
+ * runLayer() plays a program on top of the ring instead, in one of
+ * EFFECT_MAX_LAYERS layers, without stopping what's underneath. While any
+ * layer is up, every pixel is blended on its way into the strip's buffer:
+ * the ring's own color, then each layer from the bottom up, then the output
+ * table. The blends are small integer kernels, and a frame where neither the
+ * ring nor a layer changed color is still skipped.
+ */
 class NeoPixelRing
 {
 private:
     Adafruit_NeoPixel *neoPixel;
+    PixelOutput_t output;
+    void *outputContext;
+    uint32_t *colors; // The uncorrected color of each pixel
+    uint8_t *phases;  // Where each pixel sits on the wheel for rainbowCycle
+    uint8_t outputTable[256];
+    uint8_t brightness;
+    bool gammaCorrection;
+    RingEffect_t effect;
+    RGB_t startColor;
+    RGB_t endColor;
+    int16_t fadeDelta[3];
+    int64_t fadeStart;
+    uint32_t fadeReciprocal;
+    EffectProgram_t program;
+    int64_t programStart;
+    uint16_t loopsPlayed;
+    uint16_t frame;
+    uint16_t frameCount;
+    uint8_t frameInterval;
+    uint8_t holdCount;
+    bool dirty;
+    RingLayer_t layers[EFFECT_MAX_LAYERS];
+    uint8_t activeLayers; // Bit per layer
+    bool composeDirty;    // The layers need blending in again before the next show
+    bool rawFrame;        // A streamed frame is up, pixels skip the output table
+    uint32_t framesShown;
+    uint32_t framesSkipped;
+
+    void buildOutputTable(void);
+    void compose(void);
+    void endRawFrame(void);
+    void fill(uint8_t r, uint8_t g, uint8_t b);
+    void refresh(void);
+    void setPixel(uint16_t i, uint32_t color);
+    void show(void);
+    void startEffect(RingEffect_t effect, uint16_t frameCount, uint8_t frameInterval);
+    void updateLayers(int64_t now);
+    void writePixel(uint16_t i, uint8_t r, uint8_t g, uint8_t b);
 
 public:
     // Constructor
     NeoPixelRing(Adafruit_NeoPixel *neoPixel);
 
     // Destructor
-    //~NeoPixelRing();
+    ~NeoPixelRing();
 
     // Methods
     void begin(void);
-    void fadeColor(uint8_t r, uint8_t g, uint8_t b, uint16_t fadeTime);
-    void fadeColor(RGB_t *endColor, uint16_t fadeTime);
+    void clearLayer(uint8_t layer);
+    void fadeColor(uint8_t r, uint8_t g, uint8_t b, uint32_t fadeTime);
+    void fadeColor(RGB_t *endColor, uint32_t fadeTime);
+    uint8_t getBrightness(void);
+    RingEffect_t getEffect(void);
     void getColor(RGB_t *color);
+    void getTargetColor(RGB_t *color);
+    uint32_t getFramesShown(void);
+    uint32_t getFramesSkipped(void);
+    bool hasLayers(void);
+    bool isAnimating(void);
     void off(void);
     void rainbow(uint8_t wait);
     void rainbowCycle(uint8_t wait);
+    void runLayer(uint8_t layer, const EffectProgram_t *program, EffectBlend_t blend, uint8_t opacity);
+    void runProgram(const EffectProgram_t *program);
+    void redraw(void);
     void setColor(uint8_t r, uint8_t g, uint8_t b);
     void setColor(RGB_t *color);
+    void setBrightness(uint8_t brightness);
+    void setGammaCorrection(bool enabled);
+    void setOutput(PixelOutput_t output, void *context);
+    void showFrame(const uint8_t *frame, bool corrected);
+    void stop(void);
+    bool update(void);
     uint32_t wheel(uint8_t wheelPos);
     void wipeColor(uint8_t r, uint8_t g, uint8_t b);
     void wipeColor(RGB_t *color);
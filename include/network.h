@@ -0,0 +1,45 @@
+#ifndef __RGB_DINO_NETWORK_H__
+#define __RGB_DINO_NETWORK_H__
+
+#include "config.h"
+#include <stdint.h>
+#include <mqtt_client.h>
+
+/**
+ * WiFi bring up, driven by events so setup() never waits on it.
+ *
+ * The mqtt client and SNTP (see timeSync.h) are started the first time the
+ * station gets an IP. The BSSID and channel of the access point are cached
+ * in NVS, so after a reboot the connect skips the scan. If the cached access
+ * point can't be joined, the cache is dropped and it falls back to a full
+ * scan.
+ *
+ * When the broker goes away, every failed attempt doubles the wait before the
+ * next one, from MQTT_RECONNECT_MIN_MS up to MQTT_RECONNECT_MAX_MS, and each
+ * wait is picked at random from its upper half. After a broker restart the
+ * whole fleet's handshakes (a TLS one takes seconds of CPU) are spread out
+ * instead of landing on the broker, and on each other, at once. esp-mqtt's
+ * own reconnect is left running slower than that, in case a wakeup is lost.
+ *
+ * Defining WLAN_STATIC_IP (with WLAN_GATEWAY and WLAN_SUBNET, WLAN_DNS is
+ * optional) skips DHCP as well.
+ */
+#if defined(WLAN_STATIC_IP) && (!defined(WLAN_GATEWAY) || !defined(WLAN_SUBNET))
+#error "WLAN_GATEWAY and WLAN_SUBNET must be defined to use WLAN_STATIC_IP"
+#endif
+
+#ifndef MQTT_RECONNECT_MIN_MS
+#define MQTT_RECONNECT_MIN_MS 2000
+#endif
+
+#ifndef MQTT_RECONNECT_MAX_MS
+#define MQTT_RECONNECT_MAX_MS 120000
+#endif
+
+// Returns straight away, call once after the mqtt client is initialized
+void startNetwork(esp_mqtt_client_handle_t client);
+
+// Short task only, the backoff is up
+void reconnectMqtt(void);
+
+#endif
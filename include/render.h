@@ -0,0 +1,17 @@
+#ifndef __RGB_DINO_RENDER_H__
+#define __RGB_DINO_RENDER_H__
+
+#include "config.h"
+#include <freertos/FreeRTOS.h>
+
+// Length of one animation frame, the render task advances every ring once per frame
+#ifndef RENDER_FRAME_MS
+#define RENDER_FRAME_MS 10
+#endif
+
+// Task functions, the render task owns the rings, see renderChannel.h
+void applyRenderCommands(void);
+uint8_t renderFrame(void);
+void processRenderTask(void *parameter);
+
+#endif
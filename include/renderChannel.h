@@ -0,0 +1,80 @@
+#ifndef __RGB_DINO_RENDER_CHANNEL_H__
+#define __RGB_DINO_RENDER_CHANNEL_H__
+
+#include "config.h"
+#include <stdint.h>
+#include "effectProgram.h"
+#include "mqttEventProcessing.h"
+
+/**
+ * Commands to the render task, the only task that touches the rings once
+ * setup() is done.
+ *
+ * Every task that sends commands has its own single producer, single
+ * consumer ring buffer, so sending is a copy and an index store, no locks.
+ * The render task drains them all at the start of every frame. A send never
+ * drops a command: when the channel is full the sender sleeps until the
+ * render task has made room (at most a frame). Both sides wake each other
+ * with task notifications.
+ */
+#ifndef RENDER_CHANNEL_LENGTH
+#define RENDER_CHANNEL_LENGTH 8 // Commands per sender, must be a power of 2
+#endif
+
+#if RENDER_CHANNEL_LENGTH & (RENDER_CHANNEL_LENGTH - 1)
+#error "RENDER_CHANNEL_LENGTH must be a power of 2"
+#endif
+
+// One per sending task, a task only ever sends on its own
+typedef enum RenderSender : uint8_t {
+    RENDER_FROM_SHORT = 0, // Short task
+    RENDER_FROM_LONG = 1,  // Long task
+    RENDER_FROM_MQTT = 2,  // Mqtt task
+    RENDER_SENDER_COUNT,
+} RenderSender_t;
+
+typedef enum RenderCommandType : uint8_t {
+    RENDER_SET_COLOR = 0,
+    RENDER_SET_BRIGHTNESS = 1,
+    RENDER_RUN_PROGRAM = 2,  // The program has to stay put until syncRenderCommands() returns
+    RENDER_PAUSE = 3,        // The render task leaves the segment alone until RENDER_RESUME
+    RENDER_RESUME = 4,       // Redraws whatever was on the segment before the pause
+    RENDER_RUN_SEQUENCE = 5, // Same as RENDER_RUN_PROGRAM, the sequence has to stay put
+    RENDER_RUN_LAYER = 6,    // Same as RENDER_RUN_PROGRAM, unless it clears the layer
+} RenderCommandType_t;
+
+typedef struct LayerCommand {
+    const EffectProgram_t *program; // Unused when settings.clear is set
+    EffectLayer_t settings;
+} LayerCommand_t;
+
+typedef struct RenderCommand {
+    uint32_t enqueuedAt; // esp_timer timestamp (us) of when the mqtt message came in
+    uint32_t startAt;    // RENDER_SET_COLOR, esp_timer timestamp (us) it starts at, 0 is straight away
+    union {
+        ColorCommand_t command;          // RENDER_SET_COLOR
+        uint8_t brightness;              // RENDER_SET_BRIGHTNESS
+        const EffectProgram_t *program;  // RENDER_RUN_PROGRAM
+        const ColorSequence_t *sequence; // RENDER_RUN_SEQUENCE
+        LayerCommand_t layer;            // RENDER_RUN_LAYER
+    };
+    RenderCommandType_t type;
+    uint8_t segment;
+} RenderCommand_t;
+
+// Senders. Blocks while the channel is full, and wakes the render task.
+void sendRenderCommand(RenderSender_t sender, const RenderCommand_t *command);
+
+// Senders. Blocks until the render task has handled everything sent so far.
+void syncRenderCommands(RenderSender_t sender);
+
+// Any task, for anything else the render task should look at (a streamed frame)
+void wakeRenderTask(void);
+
+typedef void (*RenderCommandHandler_t)(const RenderCommand_t *command);
+
+// Render task, hands every command that's waiting to handler, oldest first
+// per sender
+void drainRenderCommands(RenderCommandHandler_t handler);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __RGB_DINO_RING_STATE_H__
+#define __RGB_DINO_RING_STATE_H__
+
+#include <stdint.h>
+#include "led.h"
+#include "neoPixelRing.h"
+#include "segment.h"
+
+/**
+ * A snapshot of each segment's ring that can be read from any task, the
+ * rings themselves belong to the render task.
+ *
+ * It's guarded by a seqlock. Only the render task writes it (setup() does
+ * too, before the render task starts), and readers retry until they get a
+ * copy that wasn't written to halfway through.
+ */
+typedef struct RingState {
+    RGB_t current;
+    RGB_t target;
+    uint8_t brightness;
+    uint8_t effect; // RingEffect_t
+} RingState_t;
+
+// Render task only, after anything that could change the ring
+void updateRingState(uint8_t segment);
+
+// Returns the version of the snapshot that was read, it changes every time the snapshot does
+uint32_t readRingState(uint8_t segment, RingState_t *state);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __RGB_DINO_RMT_OUTPUT_H__
+#define __RGB_DINO_RMT_OUTPUT_H__
+
+#include "config.h"
+#include <stdint.h>
+
+/**
+ * WS2812 output through the RMT peripheral (enabled with NEO_PIXEL_RMT)
+ *
+ * Adafruit_NeoPixel's show() waits for the whole strip to clock out before
+ * it returns. Instead, the frame is copied into a buffer the RMT driver owns
+ * and the bits are sent from its interrupt while the render task moves on. A
+ * show only waits when the previous frame is still going out.
+ *
+ * The original ESP32's RMT has no DMA, so the driver refills the channel's
+ * memory block from the interrupt. That is a few short interrupts per frame,
+ * and interrupts are never turned off.
+ */
+#ifndef NEO_PIXEL_RMT_CHANNEL
+#define NEO_PIXEL_RMT_CHANNEL RMT_CHANNEL_7 // Well clear of the channels the Arduino core hands out first
+#endif
+
+// One per segment, segment n gets channel NEO_PIXEL_RMT_CHANNEL - n
+typedef struct RmtOutput RmtOutput_t;
+
+// Call once per segment, with the buffer length in bytes (3 per pixel). Returns NULL if it fails.
+RmtOutput_t *initRmtOutput(uint8_t segment, uint8_t pin, uint16_t length);
+
+// Routes the pin back to the RMT channel, after something else drove it
+void attachRmtOutput(RmtOutput_t *output);
+
+// Render task only, a PixelOutput_t for NeoPixelRing
+void rmtOutputShow(void *output, const uint8_t *pixels, uint16_t length);
+
+#endif
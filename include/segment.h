@@ -0,0 +1,103 @@
+#ifndef __RGB_DINO_SEGMENT_H__
+#define __RGB_DINO_SEGMENT_H__
+
+#include "config.h"
+#include <stdint.h>
+#include <Adafruit_NeoPixel.h>
+#include "neoPixelRing.h"
+#include "rmtOutput.h"
+
+/**
+ * Segments, each a strip or ring on its own pin (optional, enabled by
+ * setting SEGMENT_COUNT in config.h)
+ *
+ * Segment 0 is the one on NEO_PIXEL_PIN, with NEO_PIXEL_COUNT pixels, and
+ * answers on the topics as they're configured. The others are set up with
+ * SEGMENT_<n>_PIN and SEGMENT_<n>_COUNT, and answer on the same topics with
+ * "/<n>" on the end, e.g. SUB_SET_COLOR "/1". Status publishes follow the
+ * same pattern.
+ *
+ * Every segment has its own ring, effect, brightness and stored state. Once
+ * setup() is done only the render task touches the rings, everyone else
+ * goes through renderChannel.h. With NEO_PIXEL_RMT each also gets its own RMT channel, so the render
+ * task starts every segment's frame going out and none of them wait on each
+ * other.
+ */
+#ifndef SEGMENT_COUNT
+#define SEGMENT_COUNT 1
+#endif
+
+#define SEGMENT_MAX_COUNT 4
+
+#if SEGMENT_COUNT < 1 || SEGMENT_COUNT > SEGMENT_MAX_COUNT
+#error "SEGMENT_COUNT must be between 1 and SEGMENT_MAX_COUNT"
+#endif
+#if SEGMENT_COUNT > 1 && (!defined(SEGMENT_1_PIN) || !defined(SEGMENT_1_COUNT))
+#error "SEGMENT_1_PIN and SEGMENT_1_COUNT must be defined to use 2 segments"
+#endif
+#if SEGMENT_COUNT > 2 && (!defined(SEGMENT_2_PIN) || !defined(SEGMENT_2_COUNT))
+#error "SEGMENT_2_PIN and SEGMENT_2_COUNT must be defined to use 3 segments"
+#endif
+#if SEGMENT_COUNT > 3 && (!defined(SEGMENT_3_PIN) || !defined(SEGMENT_3_COUNT))
+#error "SEGMENT_3_PIN and SEGMENT_3_COUNT must be defined to use 4 segments"
+#endif
+
+// Every segment at once, for group topics, see mqttRouter.h
+#define SEGMENT_ALL 0xFF
+
+// Longest topic a segment can be addressed on, "/<n>" included
+#define SEGMENT_TOPIC_LEN 64
+
+static constexpr uint8_t segmentPins[SEGMENT_COUNT] = {
+    NEO_PIXEL_PIN,
+#if SEGMENT_COUNT > 1
+    SEGMENT_1_PIN,
+#endif
+#if SEGMENT_COUNT > 2
+    SEGMENT_2_PIN,
+#endif
+#if SEGMENT_COUNT > 3
+    SEGMENT_3_PIN,
+#endif
+};
+
+static constexpr uint16_t segmentPixelCounts[SEGMENT_COUNT] = {
+    NEO_PIXEL_COUNT,
+#if SEGMENT_COUNT > 1
+    SEGMENT_1_COUNT,
+#endif
+#if SEGMENT_COUNT > 2
+    SEGMENT_2_COUNT,
+#endif
+#if SEGMENT_COUNT > 3
+    SEGMENT_3_COUNT,
+#endif
+};
+
+constexpr uint16_t maxSegmentPixels(uint8_t segment = 0)
+{
+    return segment >= SEGMENT_COUNT ? 0
+        : (segmentPixelCounts[segment] > maxSegmentPixels(segment + 1)
+            ? segmentPixelCounts[segment] : maxSegmentPixels(segment + 1));
+}
+
+typedef struct Segment {
+    Adafruit_NeoPixel *pixels;
+    NeoPixelRing *ring;
+    RmtOutput_t *output; // NULL unless NEO_PIXEL_RMT
+} Segment_t;
+
+extern Segment_t segments[SEGMENT_COUNT];
+
+// Call once before anything uses a segment
+void initSegments(void);
+
+// The topic a segment answers on, `topic` for segment 0 and `topic`/<n> for
+// the others. Returns the length, or 0 if it doesn't fit.
+uint16_t segmentTopic(char *output, const char *topic, uint8_t segment);
+
+// Splits the segment off the end of a topic. Returns the length of the base
+// topic, or 0 if it doesn't end in a valid "/<n>".
+uint16_t parseSegmentTopic(const char *topic, int topicLength, uint8_t *segment);
+
+#endif
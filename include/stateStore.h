@@ -0,0 +1,54 @@
+#ifndef __RGB_DINO_STATE_STORE_H__
+#define __RGB_DINO_STATE_STORE_H__
+
+#include "config.h"
+#include <stdint.h>
+#include "effectProgram.h"
+#include "mqttEventProcessing.h"
+
+/**
+ * The last color command, brightness and effect program of every segment
+ * kept in NVS, so the rings come back the way they were left after a reboot.
+ *
+ * Storing only copies the state into RAM. It's written out by the short task
+ * once nothing has changed for STATE_STORE_DELAY_MS, so a slider storm costs
+ * one flash write and nothing on the way to the pixels. Changes that never
+ * settle (a stream of commands) are still written every
+ * STATE_STORE_MAX_DELAY_MS. A write that wouldn't change what's already in
+ * flash is skipped.
+ */
+#ifndef STATE_STORE_DELAY_MS
+#define STATE_STORE_DELAY_MS 2000
+#endif
+
+#ifndef STATE_STORE_MAX_DELAY_MS
+#define STATE_STORE_MAX_DELAY_MS 60000
+#endif
+
+#if STATE_STORE_MAX_DELAY_MS < STATE_STORE_DELAY_MS
+#error "STATE_STORE_MAX_DELAY_MS can't be shorter than STATE_STORE_DELAY_MS"
+#endif
+
+#define STATE_STORE_NAMESPACE "rgb-dino"
+#define STATE_STORE_VERSION 2 // Bump when StoredState_t changes, older saves are ignored
+
+typedef struct StoredState {
+    uint8_t version;
+    uint8_t brightness;
+    ColorCommand_t command;
+} StoredState_t;
+
+bool initStateStore(void);
+
+// Boot, before the tasks start. The program is only filled in when the stored command plays one.
+bool loadStoredState(uint8_t segment, StoredState_t *state, EffectProgram_t *program);
+
+// Any task
+void storeColorCommand(uint8_t segment, const ColorCommand_t *command);
+void storeBrightness(uint8_t segment, uint8_t brightness);
+void storeEffectProgram(uint8_t segment, const EffectProgram_t *program);
+
+// Short task only
+void flushStoredState(void);
+
+#endif
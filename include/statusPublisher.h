@@ -0,0 +1,36 @@
+#ifndef __RGB_DINO_STATUS_PUBLISHER_H__
+#define __RGB_DINO_STATUS_PUBLISHER_H__
+
+#include "config.h"
+#include "mqttEventProcessing.h"
+
+// Status publishes are coalesced to at most this many per second
+#ifndef STATUS_PUBLISH_MAX_RATE
+#define STATUS_PUBLISH_MAX_RATE 5
+#endif
+
+// Publish the status retained, so late subscribers get it without asking
+#ifndef STATUS_PUBLISH_RETAIN
+#define STATUS_PUBLISH_RETAIN false
+#endif
+
+#define STATUS_PUBLISH_INTERVAL_MS (1000 / STATUS_PUBLISH_MAX_RATE)
+
+bool initStatusPublisher(void);
+
+// Short task only. Marks a segment's status as due in `format`, and publishes
+// it as soon as the rate limit allows. Unless `force` is set, a status that
+// hasn't changed since it was last published in that format is skipped. The
+// rate limit is shared, every segment that's due goes out in the same flush.
+void scheduleRgbStatus(uint8_t segment, PayloadFormat_t format, bool force);
+void flushRgbStatus(void);
+
+// Any task. Hands a segment's status publish off to the short task, in the
+// format of the last SET_COLOR. Never dropped, see actionQueue.h.
+void queueRgbStatus(uint8_t segment);
+void setRgbStatusFormat(PayloadFormat_t format);
+
+// Short task only, schedules the status queueRgbStatus() asked for
+void scheduleQueuedRgbStatus(uint8_t segment);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __RGB_DINO_TIME_SYNC_H__
+#define __RGB_DINO_TIME_SYNC_H__
+
+#include "config.h"
+#include <stdint.h>
+
+/**
+ * Wall clock, kept in sync over SNTP once the network is up. It's what lets
+ * a group of dinos agree on when a scene starts, see SET_COLOR's "at".
+ */
+#ifndef SNTP_SERVER
+#define SNTP_SERVER "pool.ntp.org"
+#endif
+
+// WiFi event task, call once the station has an IP, later calls do nothing
+void startTimeSync(void);
+
+// Any task
+bool isTimeSynced(void);
+
+// Any task. Works out when a wall clock time (ms since the epoch) is on the
+// esp_timer clock (us), returns false until the first sync.
+bool wallTimeToTimer(uint64_t wallTime, int64_t *timerTime);
+
+#endif
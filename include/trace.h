@@ -0,0 +1,52 @@
+#ifndef __RGB_DINO_TRACE_H__
+#define __RGB_DINO_TRACE_H__
+
+#include "config.h"
+#include <stdint.h>
+
+/**
+ * Hot path tracing (enabled with APP_TRACE in config.h)
+ *
+ * TRACE() writes a fixed size record into a RAM ring buffer with a single
+ * atomic add, so it's cheap enough to leave on in production builds without
+ * changing the timing it's meant to show. The oldest records get overwritten.
+ *
+ * Publishing to SUB_TRACE_DUMP makes the short task publish every record
+ * since the last dump to PUB_TRACE, as raw little endian TraceRecord_t's in
+ * chunks of TRACE_DUMP_CHUNK records.
+ */
+#ifndef APP_TRACE
+#define APP_TRACE false
+#endif
+
+#define TRACE_BUFFER_SIZE 512 // Records, must be a power of two
+#define TRACE_DUMP_CHUNK 128  // Records per published message
+
+typedef enum TraceEvent : uint16_t {
+    TRACE_MQTT_DATA = 1,      // arg: data length
+    TRACE_ACTION_QUEUED = 2,  // arg: action type
+    TRACE_ACTION_START = 3,   // arg: action type
+    TRACE_ACTION_END = 4,     // arg: action type
+    TRACE_FRAME_START = 5,
+    TRACE_FRAME_END = 6,      // arg: 1 if the frame was shown
+    TRACE_SHOW = 7,           // arg: pixel count
+    TRACE_STREAM_FRAME = 8,   // arg: 1 if the previous frame was dropped
+    TRACE_STATUS_PUBLISH = 9, // arg: payload format
+} TraceEvent_t;
+
+typedef struct TraceRecord {
+    uint32_t timestamp; // esp_timer (us)
+    uint16_t event;     // TraceEvent_t
+    uint16_t arg;
+} TraceRecord_t;
+
+#if defined(APP_TRACE) && APP_TRACE
+void traceRecord(TraceEvent_t event, uint16_t arg);
+void publishTrace(void);
+
+#define TRACE(event, arg) traceRecord(event, arg)
+#else
+#define TRACE(event, arg)
+#endif
+
+#endif
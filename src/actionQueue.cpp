@@ -0,0 +1,162 @@
+#include "config.h"
+#include "globals.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <atomic>
+
+#include "actionQueue.h"
+#include "log.h"
+#include "metrics.h"
+#include "mqttEventProcessing.h"
+#include "trace.h"
+
+#define ACTION_QUEUE_MAX_LENGTH (SHORT_ACTION_QUEUE_LENGTH > LONG_ACTION_QUEUE_LENGTH \
+    ? SHORT_ACTION_QUEUE_LENGTH : LONG_ACTION_QUEUE_LENGTH)
+
+//==============================================================================
+// State
+
+static std::atomic<uint32_t> shortSignals(0);
+
+//==============================================================================
+// Helpers
+
+static bool sendAction(QueueHandle_t queue, MetricsQueue_t id, const SubscriptionAction_t *action, TickType_t wait)
+{
+    if (xQueueSend(queue, action, wait) != pdTRUE) {
+        return false;
+    }
+
+    TRACE(TRACE_ACTION_QUEUED, action->type);
+    metricsQueueDepth(id, uxQueueMessagesWaiting(queue));
+
+    return true;
+}
+
+static bool dropOldest(QueueHandle_t queue, MetricsQueue_t id, const SubscriptionAction_t *action)
+{
+    SubscriptionAction_t oldest;
+
+    if (xQueueReceive(queue, &oldest, 0) == pdTRUE) {
+        metricsQueueOverflow(id, METRIC_OVERFLOW_DROPPED_OLDEST);
+    }
+
+    return sendAction(queue, id, action, 0);
+}
+
+// The queue is taken apart and put back together without the actions this
+// one replaces. The mqtt task is the only sender, and the receiving task can
+// only take actions off the front while that happens, which leaves more room,
+// so everything taken out fits back in.
+static bool coalesce(QueueHandle_t queue, MetricsQueue_t id, const SubscriptionAction_t *action)
+{
+    SubscriptionAction_t queued[ACTION_QUEUE_MAX_LENGTH];
+    uint8_t count = 0;
+    uint8_t i = 0;
+    bool replaced = false;
+
+    while (count < ACTION_QUEUE_MAX_LENGTH && xQueueReceive(queue, &queued[count], 0) == pdTRUE) {
+        if (queued[count].type == action->type && queued[count].format == action->format
+            && queued[count].segment == action->segment) {
+            metricsQueueOverflow(id, METRIC_OVERFLOW_COALESCED);
+            replaced = true;
+        } else {
+            count++;
+        }
+    }
+
+    // Nothing to merge with, so the oldest goes
+    if (!replaced && count) {
+        metricsQueueOverflow(id, METRIC_OVERFLOW_DROPPED_OLDEST);
+        i = 1;
+    }
+
+    for (; i < count; i++) {
+        xQueueSend(queue, &queued[i], 0);
+    }
+
+    return sendAction(queue, id, action, 0);
+}
+
+static bool queueAction(QueueHandle_t queue, MetricsQueue_t id, ActionQueuePolicy_t policy, const SubscriptionAction_t *action)
+{
+    bool queued;
+
+    // The common case, there's room
+    if (sendAction(queue, id, action, 0)) {
+        return true;
+    }
+
+    switch (policy) {
+        case QUEUE_POLICY_DROP_OLDEST:
+            queued = dropOldest(queue, id, action);
+            break;
+        case QUEUE_POLICY_COALESCE:
+            queued = coalesce(queue, id, action);
+            break;
+        case QUEUE_POLICY_WAIT:
+            metricsQueueOverflow(id, METRIC_OVERFLOW_WAITED);
+            queued = sendAction(queue, id, action, pdMS_TO_TICKS(ACTION_QUEUE_WAIT_MS));
+            break;
+        default:
+            queued = false;
+            break;
+    }
+
+    if (!queued) {
+        APP_LOG(F("action queue is full, action dropped"));
+        metricsQueueOverflow(id, METRIC_OVERFLOW_DROPPED_NEWEST);
+    }
+
+    return queued;
+}
+
+//==============================================================================
+// Action queue functions
+
+// The short task sleeps on its notification rather than the queue, so the
+// signals can wake it too
+static void wakeShortTask(void)
+{
+    // NULL until setup() starts it, it looks at the queue and the signals first thing
+    if (processShortTaskHandle) {
+        xTaskNotifyGive(processShortTaskHandle);
+    }
+}
+
+bool queueShortAction(const SubscriptionAction_t *action)
+{
+    bool queued = queueAction(shortActionQueue, METRIC_QUEUE_SHORT, SHORT_ACTION_QUEUE_POLICY, action);
+
+    if (queued) {
+        wakeShortTask();
+    }
+
+    return queued;
+}
+
+bool queueLongAction(const SubscriptionAction_t *action)
+{
+    return queueAction(longActionQueue, METRIC_QUEUE_LONG, LONG_ACTION_QUEUE_POLICY, action);
+}
+
+void signalShortTask(uint32_t signals)
+{
+    shortSignals.fetch_or(signals);
+    wakeShortTask();
+}
+
+uint32_t takeShortSignals(void)
+{
+    // Checked first, it's nearly always 0
+    if (!shortSignals.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+
+    return shortSignals.exchange(0);
+}
@@ -0,0 +1,186 @@
+#include "config.h"
+#include "globals.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <ArduinoJson.h>
+#include <Adafruit_NeoPixel.h>
+#include <esp_timer.h>
+#include <mqtt_client.h>
+#include <new>
+
+#include "benchmark.h"
+#include "log.h"
+#include "memoryAudit.h"
+#include "mqttEventProcessing.h"
+#include "neoPixelRing.h"
+#include "renderChannel.h"
+#include "ringState.h"
+
+#if defined(APP_BENCHMARK) && APP_BENCHMARK
+
+#if !defined(SUB_BENCHMARK) || !defined(PUB_BENCHMARK)
+#error "SUB_BENCHMARK and PUB_BENCHMARK must be defined to use APP_BENCHMARK"
+#endif
+
+#define BENCHMARK_MAX_STEPS 8
+#define BENCHMARK_JSON_CAPACITY (JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(BENCHMARK_MAX_STEPS) \
+    + BENCHMARK_MAX_STEPS * (JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(4)))
+#define BENCHMARK_OUTPUT_LEN 1024
+
+static const char benchmarkPayload[] = "{\"r\": 255, \"g\": 128, \"b\": 0, \"time\": 100}";
+
+// Too big for the short task's stack, and only the short task benchmarks
+static StaticJsonDocument<BENCHMARK_JSON_CAPACITY> benchmarkDoc;
+static char benchmarkOutput[BENCHMARK_OUTPUT_LEN];
+
+AUDIT_STATIC("benchmark", benchmarkDoc);
+AUDIT_STATIC("benchmark", benchmarkOutput);
+
+//==============================================================================
+// Helpers
+
+// Leaves a tick between shows, so the 300us latch the strip needs after every
+// show isn't counted. The render task never shows back to back either.
+static uint32_t timeShow(Adafruit_NeoPixel *pixels)
+{
+    uint32_t total = 0;
+    int64_t start;
+    uint8_t i;
+
+    for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        pixels->setPixelColor(0, i, i, i);
+        vTaskDelay(1);
+        start = esp_timer_get_time();
+        pixels->show();
+        total += (uint32_t)(esp_timer_get_time() - start);
+    }
+
+    return total / BENCHMARK_ITERATIONS;
+}
+
+// One update() of whatever effect the ring was just given, including the show
+// when the frame changed any pixels
+static uint32_t timeFrames(NeoPixelRing *ring)
+{
+    uint32_t total = 0;
+    int64_t start;
+    uint8_t i;
+
+    for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        vTaskDelay(1);
+        start = esp_timer_get_time();
+        ring->update();
+        total += (uint32_t)(esp_timer_get_time() - start);
+    }
+
+    ring->stop();
+
+    return total / BENCHMARK_ITERATIONS;
+}
+
+static bool benchmarkPixels(JsonArray results, uint16_t count, uint8_t brightness)
+{
+    Adafruit_NeoPixel *pixels = new (std::nothrow) Adafruit_NeoPixel(count, NEO_PIXEL_PIN, NEO_GRB + NEO_KHZ800);
+    NeoPixelRing *scratch = pixels ? new (std::nothrow) NeoPixelRing(pixels) : NULL;
+
+    if (!scratch) {
+        APP_LOGF("not enough heap to benchmark %u pixels\n", count);
+        delete pixels;
+        return false;
+    }
+
+    scratch->setGammaCorrection(NEO_PIXEL_GAMMA);
+    scratch->setBrightness(brightness);
+    scratch->begin();
+
+    JsonObject result = results.createNestedObject();
+    result["count"] = count;
+    result["show_us"] = timeShow(pixels);
+
+    JsonObject frames = result.createNestedObject("frame_us");
+    scratch->fadeColor(255, 0, 0, BENCHMARK_ITERATIONS * 2);
+    frames["fade"] = timeFrames(scratch);
+    scratch->wipeColor(0, 255, 0);
+    frames["wipe"] = timeFrames(scratch);
+    scratch->rainbow(1);
+    frames["rainbow"] = timeFrames(scratch);
+    scratch->rainbowCycle(1);
+    frames["rainbow_cycle"] = timeFrames(scratch);
+
+    delete scratch;
+    delete pixels;
+
+    return true;
+}
+
+static void benchmarkJson(JsonObject results)
+{
+    StaticJsonDocument<SET_COLOR_JSON_CAPACITY> parseDoc;
+    StaticJsonDocument<JSON_OBJECT_SIZE(4)> statusDoc;
+    char output[SUBSCRIPTIONDATALEN];
+    int64_t start;
+    uint8_t i;
+
+    start = esp_timer_get_time();
+    for (i = 0; i < BENCHMARK_JSON_ITERATIONS; i++) {
+        deserializeJson(parseDoc, benchmarkPayload, sizeof(benchmarkPayload) - 1);
+    }
+    results["parse_us"] = (uint32_t)(esp_timer_get_time() - start) / BENCHMARK_JSON_ITERATIONS;
+
+    start = esp_timer_get_time();
+    for (i = 0; i < BENCHMARK_JSON_ITERATIONS; i++) {
+        statusDoc.clear();
+        statusDoc["r"] = 255;
+        statusDoc["g"] = 128;
+        statusDoc["b"] = i;
+        statusDoc["brightness"] = 255;
+        serializeJson(statusDoc, output, sizeof(output));
+    }
+    results["serialize_us"] = (uint32_t)(esp_timer_get_time() - start) / BENCHMARK_JSON_ITERATIONS;
+}
+
+//==============================================================================
+// Benchmark functions
+
+void runBenchmark(void)
+{
+    APP_LOG(F("runBenchmark()"));
+
+    RenderCommand_t command;
+    RingState_t state;
+    uint32_t count;
+    size_t length;
+
+    // Once the render task has the pause, segment 0 is ours until the resume
+    command.type = RENDER_PAUSE;
+    command.segment = 0;
+    command.enqueuedAt = (uint32_t)esp_timer_get_time();
+    command.startAt = 0;
+    sendRenderCommand(RENDER_FROM_SHORT, &command);
+    syncRenderCommands(RENDER_FROM_SHORT);
+    readRingState(0, &state);
+
+    benchmarkDoc.clear();
+
+    JsonArray pixels = benchmarkDoc.createNestedArray("pixels");
+    for (count = NEO_PIXEL_COUNT; count <= BENCHMARK_MAX_PIXELS && pixels.size() < BENCHMARK_MAX_STEPS; count *= 2) {
+        if (!benchmarkPixels(pixels, count, state.brightness)) {
+            break;
+        }
+    }
+
+    // The render task puts back what the scratch strip wrote over
+    command.type = RENDER_RESUME;
+    sendRenderCommand(RENDER_FROM_SHORT, &command);
+
+    benchmarkJson(benchmarkDoc.createNestedObject("json"));
+
+    length = serializeJson(benchmarkDoc, benchmarkOutput, sizeof(benchmarkOutput));
+    esp_mqtt_client_publish(mqttClient, PUB_BENCHMARK, benchmarkOutput, length, 0, 0);
+}
+
+#endif
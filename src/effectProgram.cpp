@@ -0,0 +1,246 @@
+#include "config.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <ArduinoJson.h>
+
+#include "effectProgram.h"
+#include "led.h"
+#include "log.h"
+#include "memoryAudit.h"
+
+#define EFFECT_MIN_SPEED 10
+#define EFFECT_MAX_SPEED 1000
+
+// Keys, the mode and the palette strings all get copied out of the (read only) mqtt buffer
+#define EFFECT_JSON_CAPACITY (JSON_OBJECT_SIZE(6) + JSON_ARRAY_SIZE(EFFECT_MAX_PALETTE) \
+    + JSON_ARRAY_SIZE(EFFECT_MAX_KEYFRAMES) + EFFECT_MAX_KEYFRAMES * JSON_ARRAY_SIZE(2) \
+    + EFFECT_MAX_PALETTE * 8 + 64)
+
+// Too big for the mqtt task's stack to be comfortable, and only the mqtt task parses
+static StaticJsonDocument<EFFECT_JSON_CAPACITY> effectDoc;
+
+AUDIT_STATIC("effect", effectDoc);
+
+//==============================================================================
+// Helpers
+
+// "0040ff" or "#0040ff"
+static bool parseHexColor(const char *hex, RGB_t *color)
+{
+    char *end;
+    uint32_t value;
+
+    if (!hex) {
+        return false;
+    }
+    if (hex[0] == '#') {
+        hex++;
+    }
+    if (strlen(hex) != 6) {
+        return false;
+    }
+
+    value = strtoul(hex, &end, 16);
+    if (*end != '\0') {
+        return false;
+    }
+
+    color->r = (uint8_t)(value >> 16);
+    color->g = (uint8_t)(value >> 8);
+    color->b = (uint8_t)value;
+
+    return true;
+}
+
+static bool parseInterpolation(const char *mode, EffectInterpolation_t *interpolation)
+{
+    if (!mode || strcmp(mode, "linear") == 0) {
+        *interpolation = INTERPOLATE_LINEAR;
+    } else if (strcmp(mode, "step") == 0) {
+        *interpolation = INTERPOLATE_STEP;
+    } else if (strcmp(mode, "smooth") == 0) {
+        *interpolation = INTERPOLATE_SMOOTH;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static bool parseBlend(const char *blend, EffectBlend_t *mode)
+{
+    if (!blend || strcmp(blend, "normal") == 0) {
+        *mode = BLEND_NORMAL;
+    } else if (strcmp(blend, "add") == 0) {
+        *mode = BLEND_ADD;
+    } else if (strcmp(blend, "multiply") == 0) {
+        *mode = BLEND_MULTIPLY;
+    } else if (strcmp(blend, "screen") == 0) {
+        *mode = BLEND_SCREEN;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// "layer", "blend", "opacity" and "clear", see effectProgram.h
+static bool parseLayer(EffectLayer_t *layer)
+{
+    uint32_t index = effectDoc["layer"] | 0;
+    uint32_t opacity = effectDoc["opacity"] | 255;
+
+    if (index > EFFECT_MAX_LAYERS) {
+        APP_LOG(F("effect layer is out of range"));
+        return false;
+    }
+    if (opacity > 255) {
+        APP_LOG(F("effect opacity is out of range"));
+        return false;
+    }
+    if (!parseBlend(effectDoc["blend"].as<const char *>(), &layer->blend)) {
+        APP_LOG(F("unknown effect blend"));
+        return false;
+    }
+
+    layer->layer = (uint8_t)index;
+    layer->opacity = (uint8_t)opacity;
+    layer->clear = index && (effectDoc["clear"] | false);
+
+    return true;
+}
+
+//==============================================================================
+// Effect program functions
+
+// Mqtt task only
+bool parseEffectProgram(EffectProgram_t *program, EffectLayer_t *layer, const char *json, size_t length)
+{
+    EffectProgram_t parsed;
+    RGB_t palette[EFFECT_MAX_PALETTE];
+    uint8_t paletteSize = 0;
+    uint32_t speed;
+    uint32_t spread;
+    uint16_t at;
+    uint8_t index;
+    uint8_t i;
+
+    if (length > EFFECT_JSON_LEN) {
+        APP_LOG(F("effect descriptor is to long"));
+        return false;
+    }
+
+    DeserializationError error = deserializeJson(effectDoc, json, length);
+    if (error) {
+        APP_LOG(&error);
+        return false;
+    }
+
+    if (!parseLayer(layer)) {
+        return false;
+    }
+    if (layer->clear) {
+        return true;
+    }
+
+    memset(&parsed, 0, sizeof(EffectProgram_t));
+
+    JsonArray colors = effectDoc["palette"];
+    if (colors.isNull() || colors.size() == 0 || colors.size() > EFFECT_MAX_PALETTE) {
+        APP_LOG(F("effect needs 1 - 16 palette colors"));
+        return false;
+    }
+    for (JsonVariant color : colors) {
+        if (!parseHexColor(color.as<const char *>(), &palette[paletteSize++])) {
+            APP_LOG(F("effect palette colors are 6 digit hex"));
+            return false;
+        }
+    }
+
+    JsonArray keyframes = effectDoc["keyframes"];
+    if (keyframes.isNull() || keyframes.size() < 2 || keyframes.size() > EFFECT_MAX_KEYFRAMES) {
+        APP_LOG(F("effect needs 2 - 16 keyframes"));
+        return false;
+    }
+    for (JsonVariant keyframe : keyframes) {
+        at = keyframe[0].as<uint16_t>();
+        index = keyframe[1].as<uint8_t>();
+
+        // Keyframes start at 0, and each one comes after the last
+        if (index >= paletteSize || (parsed.keyframeCount == 0 ? at != 0 : at <= parsed.keyframes[parsed.keyframeCount - 1].at)) {
+            APP_LOG(F("effect keyframes are out of order"));
+            return false;
+        }
+
+        parsed.keyframes[parsed.keyframeCount].at = at;
+        parsed.keyframes[parsed.keyframeCount].color = palette[index];
+        parsed.keyframeCount++;
+    }
+
+    if (!parseInterpolation(effectDoc["mode"].as<const char *>(), &parsed.interpolation)) {
+        APP_LOG(F("unknown effect mode"));
+        return false;
+    }
+
+    speed = effectDoc["speed"] | 100;
+    if (speed < EFFECT_MIN_SPEED || speed > EFFECT_MAX_SPEED) {
+        APP_LOG(F("effect speed is out of range"));
+        return false;
+    }
+
+    spread = effectDoc["spread"] | 0;
+    if (spread > 255) {
+        APP_LOG(F("effect spread is out of range"));
+        return false;
+    }
+
+    parsed.spread = (uint8_t)spread;
+    parsed.loops = effectDoc["loops"] | 0;
+    parsed.duration = parsed.keyframes[parsed.keyframeCount - 1].at;
+    parsed.speedScale = (uint32_t)(((uint64_t)speed << 32) / 100000);
+    parsed.loopTime = (uint32_t)(((uint64_t)parsed.duration * 100000) / speed);
+
+    for (i = 0; i < parsed.keyframeCount - 1; i++) {
+        parsed.reciprocals[i] = (uint32_t)(((1ULL << 32) - 1) / (parsed.keyframes[i + 1].at - parsed.keyframes[i].at));
+    }
+
+    *program = parsed;
+
+    return true;
+}
+
+// Any task, only reads the program
+void sampleEffectProgram(const EffectProgram_t *program, uint16_t at, RGB_t *color)
+{
+    const EffectKeyframe_t *from;
+    const EffectKeyframe_t *to;
+    uint32_t progress;
+    uint8_t i = 0;
+
+    while (i + 2 < program->keyframeCount && program->keyframes[i + 1].at <= at) {
+        i++;
+    }
+
+    from = &program->keyframes[i];
+    to = &program->keyframes[i + 1];
+
+    if (program->interpolation == INTERPOLATE_STEP) {
+        *color = from->color;
+        return;
+    }
+
+    // 0.16 fixed point fraction of the segment, like the fades
+    progress = (uint32_t)(((uint64_t)(at - from->at) * program->reciprocals[i]) >> 16);
+    if (progress > 0xFFFF) {
+        progress = 0xFFFF;
+    }
+    if (program->interpolation == INTERPOLATE_SMOOTH) {
+        // smoothstep, 3p^2 - 2p^3
+        progress = (uint32_t)(((uint64_t)progress * progress * (3 * 0x10000 - 2 * progress)) >> 32);
+    }
+
+    color->r = from->color.r + ((((int32_t)to->color.r - from->color.r) * (int32_t)progress) >> 16);
+    color->g = from->color.g + ((((int32_t)to->color.g - from->color.g) * (int32_t)progress) >> 16);
+    color->b = from->color.b + ((((int32_t)to->color.b - from->color.b) * (int32_t)progress) >> 16);
+}
@@ -0,0 +1,89 @@
+#include "config.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+
+#include "frameStream.h"
+#include "log.h"
+#include "memoryAudit.h"
+#include "renderChannel.h"
+#include "trace.h"
+
+//==============================================================================
+// Frame buffers
+
+// Three buffers per segment so neither side ever waits on the other: the
+// mqtt task owns `writeIndex`, the render task owns `readIndex`, and the two
+// only meet for an index swap on `readyIndex`.
+typedef struct FrameBuffers {
+    uint8_t frames[3][STREAM_FRAME_MAX_LEN];
+    uint8_t writeIndex = 0;
+    uint8_t readyIndex = 1;
+    uint8_t readIndex = 2;
+    bool frameReady = false;
+} FrameBuffers_t;
+
+static FrameBuffers_t streams[SEGMENT_COUNT];
+static uint32_t droppedFrames = 0;
+static portMUX_TYPE streamMux = portMUX_INITIALIZER_UNLOCKED;
+
+AUDIT_STATIC("stream", streams);
+
+//==============================================================================
+// Stream functions
+
+bool frameStreamWrite(uint8_t segment, const uint8_t *data, int length)
+{
+    FrameBuffers_t *stream = &streams[segment];
+    uint8_t index;
+    bool dropped;
+
+    if (length != STREAM_FRAME_LEN(segment)) {
+        APP_LOG(F("stream frame has the wrong length"));
+        return false;
+    }
+
+    memcpy(stream->frames[stream->writeIndex], data, length);
+
+    portENTER_CRITICAL(&streamMux);
+    dropped = stream->frameReady;
+    if (dropped) {
+        droppedFrames++;
+    }
+    index = stream->readyIndex;
+    stream->readyIndex = stream->writeIndex;
+    stream->writeIndex = index;
+    stream->frameReady = true;
+    portEXIT_CRITICAL(&streamMux);
+
+    TRACE(TRACE_STREAM_FRAME, dropped);
+    wakeRenderTask();
+
+    return true;
+}
+
+const uint8_t *frameStreamRead(uint8_t segment)
+{
+    FrameBuffers_t *stream = &streams[segment];
+    uint8_t index;
+
+    portENTER_CRITICAL(&streamMux);
+    if (!stream->frameReady) {
+        portEXIT_CRITICAL(&streamMux);
+        return NULL;
+    }
+    index = stream->readyIndex;
+    stream->readyIndex = stream->readIndex;
+    stream->readIndex = index;
+    stream->frameReady = false;
+    portEXIT_CRITICAL(&streamMux);
+
+    return stream->frames[stream->readIndex];
+}
+
+uint32_t frameStreamDropped(void)
+{
+    return droppedFrames;
+}
@@ -2,6 +2,7 @@
 #include <Arduino.h>
 #include <HardwareSerial.h>
 #include <ArduinoJson.h>
+#include <esp_timer.h>
 #include "log.h"
 #include "mqttEventProcessing.h"
 
@@ -41,7 +42,13 @@ void appLog(SubscriptionAction_t *action)
 {
     Serial.println(F("[action]"));
     Serial.printf("  type: %i\n", action->type);
-    Serial.printf("  data: %.*s\n", action->dataLength, action->data);
-    Serial.printf("  data len: %i\n", action->dataLength);
+    Serial.printf("  color: %u, %u, %u\n", action->command.color.r, action->command.color.g, action->command.color.b);
+    Serial.printf("  effect: %u\n", action->command.effect);
+    Serial.printf("  time: %u\n", action->command.time);
+}
+
+void appLogLatency(SubscriptionAction_t *action)
+{
+    Serial.printf("[latency] type: %i, queued -> handler: %u us\n", action->type, (uint32_t)esp_timer_get_time() - action->enqueuedAt);
 }
 #endif
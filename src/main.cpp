@@ -3,50 +3,44 @@
 // FreeRtos
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <freertos/semphr.h>
 #include <freertos/queue.h>
 // Library Headers
 #include <Arduino.h>
 #include <HardwareSerial.h>
-#include <WiFi.h> // ESP32 Wifi client library
 #include <mqtt_client.h>
 #include <Adafruit_NeoPixel.h>
 #include <ArduinoJson.h>
 #include <esp_log.h>
 // Custom Headers
+#include "effectProgram.h"
+#include "memoryAudit.h"
+#include "metrics.h"
 #include "mqttEventProcessing.h"
+#include "mqttRouter.h"
 #include "neoPixelRing.h"
+#include "network.h"
+#include "render.h"
+#include "ringState.h"
+#include "rmtOutput.h"
+#include "segment.h"
+#include "stateStore.h"
+#include "statusPublisher.h"
 
 //==============================================================================
 // Globals
 
-/**
- *  Adafruit NeoPixel object
- *
- *  Argument 1 = Number of pixels in NeoPixel strip
- *  Argument 2 = Arduino pin number (most are valid)
- *  Argument 3 = Pixel type flags, add together as needed:
- *      NEO_KHZ800  800 KHz bitstream (most NeoPixel products w/WS2812 LEDs)
- *      NEO_KHZ400  400 KHz (classic 'v1' (not v2) FLORA pixels, WS2811 drivers)
- *      NEO_GRB     Pixels are wired for GRB bitstream (most NeoPixel products)
- *      NEO_RGB     Pixels are wired for RGB bitstream (v1 FLORA pixels, not v2)
- *      NEO_RGBW    Pixels are wired for RGBW bitstream (NeoPixel RGBW products)
- */
-Adafruit_NeoPixel neoPixels(NEO_PIXEL_COUNT, NEO_PIXEL_PIN, NEO_GRB + NEO_KHZ800);
-NeoPixelRing ring(&neoPixels);
+// The strips and rings are in segment.cpp
 
 // Task handles
 TaskHandle_t mqttTaskHandle = NULL;
 TaskHandle_t processShortTaskHandle = NULL;
 TaskHandle_t processLongTaskHandle = NULL;
+TaskHandle_t renderTaskHandle = NULL;
 
 // Queues
 QueueHandle_t shortActionQueue = NULL;
 QueueHandle_t longActionQueue = NULL;
 
-// Mutexes
-SemaphoreHandle_t ringMutex = NULL;
-
 // Mqtt client
 esp_mqtt_client_handle_t mqttClient = NULL;
 esp_mqtt_client_config_t mqttConfig = {
@@ -57,14 +51,49 @@ esp_mqtt_client_config_t mqttConfig = {
     .username = MQTT_USER,
     .password = MQTT_PASS,
 #endif
-    .task_prio = 5,
-    .task_stack = 6144,
-    .buffer_size = 2048,
+    .disable_clean_session = MQTT_PERSISTENT_SESSION,
+    .keepalive = MQTT_KEEPALIVE,
+    .task_prio = MQTT_TASK_PRIORITY,
+    .task_stack = MQTT_TASK_STACK,
+    .buffer_size = MQTT_BUFFER_SIZE,
 #if defined(MQTT_SECURE) && MQTT_SECURE
     .cert_pem = (const char *)broker_cert,
 #endif
+    // The backoff in network.cpp normally reconnects well before this
+    .reconnect_timeout_ms = 2 * MQTT_RECONNECT_MAX_MS,
+    .out_buffer_size = MQTT_OUT_BUFFER_SIZE,
+    .network_timeout_ms = MQTT_NETWORK_TIMEOUT_MS,
 };
 
+//==============================================================================
+// Helpers
+
+// Brings a segment's ring up the way it was left, before the network starts.
+// The render task isn't running yet, so the ring is still ours to touch.
+static void beginSegment(uint8_t index)
+{
+    Segment_t *segment = &segments[index];
+    StoredState_t state;
+    static EffectProgram_t program;
+    bool restored = loadStoredState(index, &state, &program);
+
+    segment->ring->setGammaCorrection(NEO_PIXEL_GAMMA);
+    segment->ring->setBrightness(restored ? state.brightness : NEO_PIXEL_BRIGHTNESS);
+    segment->ring->begin();
+#if NEO_PIXEL_RMT
+    // After begin(), it leaves the pin set up as a plain gpio
+    segment->output = initRmtOutput(index, segmentPins[index], segmentPixelCounts[index] * 3);
+    APP_FAIL_IF(!segment->output, F("Failed to start the rmt output"));
+    segment->ring->setOutput(rmtOutputShow, segment->output);
+#endif
+    if (restored && state.command.effect == EFFECT_PROGRAM) {
+        segment->ring->runProgram(&program);
+    } else if (restored) {
+        applyColorCommand(segment->ring, &state.command);
+    }
+    updateRingState(index);
+}
+
 //==============================================================================
 // Main
 
@@ -72,65 +101,72 @@ esp_mqtt_client_config_t mqttConfig = {
 void setup()
 {
     Serial.begin(115200);
-    vTaskDelay(500 / portTICK_PERIOD_MS);
 
-    // Connect to Wifi
-    Serial.println("");
-    Serial.print(F("Connecting to "));
-    Serial.print(WLAN_SSID);
+    // The rings come up first, wifi and mqtt are brought up from events after
+    // setup() is done, so the last colors show without waiting on the network
+    uint8_t segment;
 
-    WiFi.begin(WLAN_SSID, WLAN_PASS);
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(250);
-        Serial.print(".");
-    }
-
-    Serial.println(F("Success!"));
-    Serial.print(F("IP address: "));
-    Serial.println(WiFi.localIP());
+    AUDIT_HEAP("boot");
 
     // Configure RTOS
-    shortActionQueue = xQueueCreate(5, sizeof(SubscriptionAction_t));
+    shortActionQueue = xQueueCreate(SHORT_ACTION_QUEUE_LENGTH, sizeof(SubscriptionAction_t));
     APP_FAIL_IF(!shortActionQueue, F("Failed to ceate shortActionQueue"));
-    longActionQueue = xQueueCreate(5, sizeof(SubscriptionAction_t));
+    longActionQueue = xQueueCreate(LONG_ACTION_QUEUE_LENGTH, sizeof(SubscriptionAction_t));
     APP_FAIL_IF(!longActionQueue, F("Failed to ceate longActionQueue"))
-    ringMutex = xSemaphoreCreateMutex();
-    APP_FAIL_IF(!ringMutex, F("Failed to ceate ringMutex"));
-
-    // Initialize neopixel ring
-    if (xSemaphoreTake(ringMutex, 0) == pdTRUE) {
-        ring.begin();
-        xSemaphoreGive(ringMutex);
-    } else {
-        Serial.println(F("Didn't start ring"));
-        while(1);
+    initSegments();
+    APP_FAIL_IF(!initStatusPublisher(), F("Failed to ceate the status publisher"));
+    APP_FAIL_IF(!initMetrics(), F("Failed to ceate the metrics timer"));
+    APP_FAIL_IF(!initStateStore(), F("Failed to open the state store"));
+    AUDIT_HEAP("pipeline");
+
+    // Initialize neopixel rings
+    for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+        beginSegment(segment);
     }
+    AUDIT_HEAP("segments");
 
     // Create the tasks that process the incomming mqtt data
     xTaskCreatePinnedToCore(
         processShortTask,        // Function to be called
         "Process Short Actions", // Name of task
-        2048,                    // Stack size (bytes in ESP32, words in FreeRTOS)
+        SHORT_TASK_STACK,        // Stack size (bytes in ESP32, words in FreeRTOS)
         NULL,                    // Parameter to pass to function
-        2,                       // Task priority (0 to configMAX_PRIORITIES - 1)
+        SHORT_TASK_PRIORITY,     // Task priority (0 to configMAX_PRIORITIES - 1)
         &processShortTaskHandle, // Task handle
-        APP_CPU_NUM              // Run on core
+        NETWORK_CPU              // Run on core
     );
     xTaskCreatePinnedToCore(
         processLongTask,         // Function to be called
         "Process Long Actions",  // Name of task
-        2048,                    // Stack size (bytes in ESP32, words in FreeRTOS)
+        LONG_TASK_STACK,         // Stack size (bytes in ESP32, words in FreeRTOS)
         NULL,                    // Parameter to pass to function
-        1,                       // Task priority (0 to configMAX_PRIORITIES - 1)
+        LONG_TASK_PRIORITY,      // Task priority (0 to configMAX_PRIORITIES - 1)
         &processLongTaskHandle,  // Task handle
-        APP_CPU_NUM              // Run on core
+        NETWORK_CPU              // Run on core
     );
 
+    // Create the task that advances the ring's effects one frame at a time
+    xTaskCreatePinnedToCore(
+        processRenderTask,       // Function to be called
+        "Render Ring",           // Name of task
+        RENDER_TASK_STACK,       // Stack size (bytes in ESP32, words in FreeRTOS)
+        NULL,                    // Parameter to pass to function
+        RENDER_TASK_PRIORITY,    // Task priority (0 to configMAX_PRIORITIES - 1)
+        &renderTaskHandle,       // Task handle
+        RENDER_CPU               // Run on core
+    );
+    AUDIT_HEAP("tasks");
+
     // Start the mqtt task
+    initMqttRoutes();
     mqttClient = esp_mqtt_client_init(&mqttConfig);
     APP_FAIL_IF(!mqttClient, F("mqtt client failed to initialize..."));
     esp_mqtt_client_register_event(mqttClient, MQTT_EVENT_ANY, mqtt_event_handler, NULL);
-    esp_mqtt_client_start(mqttClient);
+    AUDIT_HEAP("mqtt");
+
+    // Connects in the background and starts the mqtt client once it has an IP
+    startNetwork(mqttClient);
+    AUDIT_HEAP("network");
 
     Serial.println(F("Finished Setup"));
     Serial.println();
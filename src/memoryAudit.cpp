@@ -0,0 +1,150 @@
+#include "config.h"
+#include "globals.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <ArduinoJson.h>
+#include <esp_heap_caps.h>
+#include <mqtt_client.h>
+
+#include "log.h"
+#include "memoryAudit.h"
+#include "metrics.h"
+#include "mqttEventProcessing.h"
+
+#if defined(APP_MEMORY_AUDIT) && APP_MEMORY_AUDIT
+
+#if !defined(SUB_MEMORY_AUDIT) || !defined(PUB_MEMORY_AUDIT)
+#error "SUB_MEMORY_AUDIT and PUB_MEMORY_AUDIT must be defined to use APP_MEMORY_AUDIT"
+#endif
+
+#define MEMORY_AUDIT_MAX_SUBSYSTEMS 24
+#define MEMORY_AUDIT_JSON_CAPACITY (JSON_OBJECT_SIZE(6) + JSON_OBJECT_SIZE(5) + 5 * JSON_OBJECT_SIZE(2) \
+    + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(MEMORY_AUDIT_MAX_STAGES) + JSON_OBJECT_SIZE(MEMORY_AUDIT_MAX_SUBSYSTEMS) \
+    + JSON_OBJECT_SIZE(2) + 2 * JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(2))
+#define MEMORY_AUDIT_OUTPUT_LEN 1024
+
+typedef struct HeapStage {
+    const char *name;
+    uint32_t taken; // Bytes
+} HeapStage_t;
+
+// Built up by the MemoryAuditStatic constructors before setup() runs, read
+// only after that
+static MemoryAuditStatic *statics = NULL;
+
+// Only setup() writes these, before the short task exists
+static HeapStage_t stages[MEMORY_AUDIT_MAX_STAGES];
+static uint8_t stageCount = 0;
+static uint32_t lastFree = 0;
+
+// Too big for the short task's stack, and only the short task publishes
+static StaticJsonDocument<MEMORY_AUDIT_JSON_CAPACITY> auditDoc;
+static char auditOutput[MEMORY_AUDIT_OUTPUT_LEN];
+
+AUDIT_STATIC("memory_audit", auditDoc);
+AUDIT_STATIC("memory_audit", auditOutput);
+
+//==============================================================================
+// Helpers
+
+static void addStack(JsonObject stacks, const char *name, TaskHandle_t task, uint32_t size)
+{
+    JsonObject stack = stacks.createNestedObject(name);
+
+    stack["size"] = size;
+    stack["unused"] = task ? uxTaskGetStackHighWaterMark(task) : 0;
+}
+
+static void addQueue(JsonObject queues, const char *name, uint32_t length, uint32_t itemSize, uint32_t max)
+{
+    JsonObject queue = queues.createNestedObject(name);
+
+    queue["length"] = length;
+    queue["item"] = itemSize;
+    queue["max"] = max;
+}
+
+// Adds size to the subsystem's total, most subsystems have a few buffers
+static void addStatic(JsonObject object, const char *subsystem, size_t size)
+{
+    object[subsystem] = object[subsystem].as<uint32_t>() + (uint32_t)size;
+}
+
+//==============================================================================
+// Audit functions
+
+MemoryAuditStatic::MemoryAuditStatic(const char *subsystem, size_t size)
+    : subsystem(subsystem), size(size), next(statics)
+{
+    statics = this;
+}
+
+void auditHeapStage(const char *stage)
+{
+    uint32_t free = esp_get_free_heap_size();
+
+    // The first stage is everything that was allocated before setup()
+    uint32_t taken = lastFree ? lastFree - free : heap_caps_get_total_size(MALLOC_CAP_DEFAULT) - free;
+
+    lastFree = free;
+    if (stageCount < MEMORY_AUDIT_MAX_STAGES) {
+        stages[stageCount].name = stage;
+        stages[stageCount].taken = taken;
+        stageCount++;
+    }
+}
+
+void publishMemoryAudit(void)
+{
+    APP_LOG(F("publishMemoryAudit()"));
+
+    MemoryAuditStatic *entry;
+    size_t length;
+    uint8_t i;
+
+    auditDoc.clear();
+
+    // Sizes as passed to xTaskCreatePinnedToCore() and esp-mqtt, in bytes
+    JsonObject stacks = auditDoc.createNestedObject("stack");
+    addStack(stacks, "short", processShortTaskHandle, SHORT_TASK_STACK);
+    addStack(stacks, "long", processLongTaskHandle, LONG_TASK_STACK);
+    addStack(stacks, "render", renderTaskHandle, RENDER_TASK_STACK);
+    addStack(stacks, "mqtt", metricsMqttTask(), MQTT_TASK_STACK);
+    addStack(stacks, "timer", xTimerGetTimerDaemonTaskHandle(), configTIMER_TASK_STACK_DEPTH);
+
+    JsonObject heap = auditDoc.createNestedObject("heap");
+    heap["free"] = esp_get_free_heap_size();
+    heap["min"] = esp_get_minimum_free_heap_size();
+    heap["largest"] = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+
+    JsonObject setup = auditDoc.createNestedObject("setup");
+    for (i = 0; i < stageCount; i++) {
+        setup[stages[i].name] = stages[i].taken;
+    }
+
+    JsonObject sizes = auditDoc.createNestedObject("static");
+    for (entry = statics; entry; entry = entry->next) {
+        addStatic(sizes, entry->subsystem, entry->size);
+    }
+
+    JsonObject queues = auditDoc.createNestedObject("queues");
+    addQueue(queues, "short", SHORT_ACTION_QUEUE_LENGTH, sizeof(SubscriptionAction_t),
+        metricsQueueHighWater(METRIC_QUEUE_SHORT));
+    addQueue(queues, "long", LONG_ACTION_QUEUE_LENGTH, sizeof(SubscriptionAction_t),
+        metricsQueueHighWater(METRIC_QUEUE_LONG));
+
+    JsonObject mqtt = auditDoc.createNestedObject("mqtt");
+    mqtt["buffer"] = MQTT_BUFFER_SIZE;
+    mqtt["out_buffer"] = MQTT_OUT_BUFFER_SIZE ? MQTT_OUT_BUFFER_SIZE : MQTT_BUFFER_SIZE;
+
+    length = serializeJson(auditDoc, auditOutput, sizeof(auditOutput));
+    esp_mqtt_client_publish(mqttClient, PUB_MEMORY_AUDIT, auditOutput, length, 0, 0);
+}
+
+#endif
@@ -0,0 +1,255 @@
+#include "config.h"
+#include "globals.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <ArduinoJson.h>
+#include <esp_timer.h>
+#include <mqtt_client.h>
+#include <atomic>
+
+#include "actionQueue.h"
+#include "frameStream.h"
+#include "log.h"
+#include "memoryAudit.h"
+#include "metrics.h"
+#include "mqttEventProcessing.h"
+
+#define METRICS_JSON_CAPACITY 1536
+#define METRICS_OUTPUT_LEN 1024
+
+//==============================================================================
+// State
+
+static std::atomic<uint32_t> counters[METRIC_COUNTER_COUNT];
+static std::atomic<uint32_t> queueHighWater[METRIC_QUEUE_COUNT];
+static std::atomic<uint32_t> queueOverflows[METRIC_QUEUE_COUNT][METRIC_OVERFLOW_COUNT];
+static std::atomic<uint32_t> queueLatency[METRICS_LATENCY_BUCKETS];
+static std::atomic<uint32_t> pixelLatency[METRICS_LATENCY_BUCKETS];
+
+// Start of the command the render task hasn't shown yet, 0 when there isn't one
+static std::atomic<uint32_t> pendingCommand(0);
+
+// Render frames, reset every time the metrics are published
+static std::atomic<uint32_t> framesRendered(0);
+static std::atomic<uint32_t> framesShown(0);
+static std::atomic<uint32_t> frameTimeTotal(0);
+static std::atomic<uint32_t> frameTimeMax(0);
+
+static TaskHandle_t mqttTask = NULL;
+static TimerHandle_t metricsTimer = NULL;
+static int64_t lastPublish = 0;
+
+// Too big for the short task's stack, and only the short task publishes
+static StaticJsonDocument<METRICS_JSON_CAPACITY> metricsDoc;
+static char metricsOutput[METRICS_OUTPUT_LEN];
+
+AUDIT_STATIC("metrics", metricsDoc);
+AUDIT_STATIC("metrics", metricsOutput);
+
+//==============================================================================
+// Helpers
+
+static uint8_t latencyBucket(uint32_t latency)
+{
+    uint32_t scaled = latency >> METRICS_LATENCY_BASE_SHIFT;
+    uint8_t bucket = scaled ? (32 - __builtin_clz(scaled)) : 0;
+
+    return bucket < METRICS_LATENCY_BUCKETS ? bucket : METRICS_LATENCY_BUCKETS - 1;
+}
+
+static void recordMax(std::atomic<uint32_t> *max, uint32_t value)
+{
+    uint32_t current = max->load(std::memory_order_relaxed);
+    while (value > current && !max->compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+static void addHistogram(JsonArray array, std::atomic<uint32_t> *histogram)
+{
+    uint8_t i;
+    for (i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        array.add(histogram[i].load(std::memory_order_relaxed));
+    }
+}
+
+static void addQueue(JsonObject object, MetricsQueue_t queue, QueueHandle_t handle)
+{
+    std::atomic<uint32_t> *overflows = queueOverflows[queue];
+
+    object["depth"] = uxQueueMessagesWaiting(handle);
+    object["max"] = queueHighWater[queue].load(std::memory_order_relaxed);
+    object["dropped_newest"] = overflows[METRIC_OVERFLOW_DROPPED_NEWEST].load(std::memory_order_relaxed);
+    object["dropped_oldest"] = overflows[METRIC_OVERFLOW_DROPPED_OLDEST].load(std::memory_order_relaxed);
+    object["coalesced"] = overflows[METRIC_OVERFLOW_COALESCED].load(std::memory_order_relaxed);
+    object["waited"] = overflows[METRIC_OVERFLOW_WAITED].load(std::memory_order_relaxed);
+}
+
+static uint32_t stackHighWater(TaskHandle_t task)
+{
+    return task ? uxTaskGetStackHighWaterMark(task) : 0;
+}
+
+#if defined(PUB_METRICS)
+static void metricsTimerCallback(TimerHandle_t timer)
+{
+    signalShortTask(SIGNAL_PUBLISH_METRICS);
+}
+#endif
+
+//==============================================================================
+// Metrics functions
+
+bool initMetrics(void)
+{
+    lastPublish = esp_timer_get_time();
+
+#if defined(PUB_METRICS)
+    metricsTimer = xTimerCreate("Metrics", pdMS_TO_TICKS(METRICS_INTERVAL_MS), pdTRUE, NULL, metricsTimerCallback);
+    if (!metricsTimer) {
+        return false;
+    }
+
+    xTimerStart(metricsTimer, 0);
+#endif
+
+    return true;
+}
+
+void metricsCount(MetricsCounter_t counter)
+{
+    counters[counter].fetch_add(1, std::memory_order_relaxed);
+}
+
+void metricsQueueDepth(MetricsQueue_t queue, uint32_t depth)
+{
+    recordMax(&queueHighWater[queue], depth);
+}
+
+// Also kept in the totals, so "commands" still adds up across both queues
+void metricsQueueOverflow(MetricsQueue_t queue, MetricsOverflow_t overflow)
+{
+    queueOverflows[queue][overflow].fetch_add(1, std::memory_order_relaxed);
+
+    if (overflow == METRIC_OVERFLOW_COALESCED) {
+        metricsCount(METRIC_COALESCED);
+    } else if (overflow != METRIC_OVERFLOW_WAITED) {
+        metricsCount(METRIC_DROPPED);
+    }
+}
+
+// Time from the action being queued to its handler picking it up
+void metricsQueueLatency(uint32_t enqueuedAt)
+{
+    queueLatency[latencyBucket((uint32_t)esp_timer_get_time() - enqueuedAt)].fetch_add(1, std::memory_order_relaxed);
+}
+
+// The ring was retargeted by a command, the next frame the render task shows
+// closes out its message to pixel latency
+void metricsCommandStarted(uint32_t enqueuedAt)
+{
+    // 0 means "nothing pending", the odd command that really was queued at 0 just gets nudged
+    pendingCommand.store(enqueuedAt ? enqueuedAt : 1, std::memory_order_relaxed);
+}
+
+// The command went straight out to the pixels, without the render task
+void metricsCommandShown(uint32_t enqueuedAt)
+{
+    pixelLatency[latencyBucket((uint32_t)esp_timer_get_time() - enqueuedAt)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void metricsFrameRendered(uint32_t frameTime, bool shown)
+{
+    uint32_t enqueuedAt;
+
+    framesRendered.fetch_add(1, std::memory_order_relaxed);
+    frameTimeTotal.fetch_add(frameTime, std::memory_order_relaxed);
+    recordMax(&frameTimeMax, frameTime);
+
+    if (!shown) {
+        return;
+    }
+
+    framesShown.fetch_add(1, std::memory_order_relaxed);
+
+    enqueuedAt = pendingCommand.exchange(0, std::memory_order_relaxed);
+    if (enqueuedAt) {
+        metricsCommandShown(enqueuedAt);
+    }
+}
+
+// esp-mqtt doesn't hand out its task handle, so the event handler passes it in
+void metricsSetMqttTask(TaskHandle_t task)
+{
+    mqttTask = task;
+}
+
+uint32_t metricsQueueHighWater(MetricsQueue_t queue)
+{
+    return queueHighWater[queue].load(std::memory_order_relaxed);
+}
+
+TaskHandle_t metricsMqttTask(void)
+{
+    return mqttTask;
+}
+
+void publishMetrics(void)
+{
+#if defined(PUB_METRICS)
+    APP_LOG(F("publishMetrics()"));
+
+    int64_t now = esp_timer_get_time();
+    uint32_t interval = (uint32_t)((now - lastPublish) / 1000); // ms
+    uint32_t rendered = framesRendered.exchange(0, std::memory_order_relaxed);
+    uint32_t shown = framesShown.exchange(0, std::memory_order_relaxed);
+    uint32_t frameTime = frameTimeTotal.exchange(0, std::memory_order_relaxed);
+    uint32_t frameMax = frameTimeMax.exchange(0, std::memory_order_relaxed);
+    size_t length;
+
+    lastPublish = now;
+    metricsDoc.clear();
+
+    metricsDoc["uptime"] = (uint32_t)(now / 1000000);
+
+    JsonObject heap = metricsDoc.createNestedObject("heap");
+    heap["free"] = esp_get_free_heap_size();
+    heap["min"] = esp_get_minimum_free_heap_size();
+
+    JsonObject queues = metricsDoc.createNestedObject("queues");
+    addQueue(queues.createNestedObject("short"), METRIC_QUEUE_SHORT, shortActionQueue);
+    addQueue(queues.createNestedObject("long"), METRIC_QUEUE_LONG, longActionQueue);
+
+    JsonObject latency = metricsDoc.createNestedObject("latency");
+    addHistogram(latency.createNestedArray("queue"), queueLatency);
+    addHistogram(latency.createNestedArray("pixel"), pixelLatency);
+
+    JsonObject render = metricsDoc.createNestedObject("render");
+    render["fps"] = interval ? (shown * 1000) / interval : 0;
+    render["frame_us_avg"] = rendered ? frameTime / rendered : 0;
+    render["frame_us_max"] = frameMax;
+    render["waits"] = counters[METRIC_RENDER_WAITS].load(std::memory_order_relaxed);
+
+    JsonObject commands = metricsDoc.createNestedObject("commands");
+    commands["rejected"] = counters[METRIC_REJECTED].load(std::memory_order_relaxed);
+    commands["coalesced"] = counters[METRIC_COALESCED].load(std::memory_order_relaxed);
+    commands["dropped"] = counters[METRIC_DROPPED].load(std::memory_order_relaxed);
+    commands["stream_dropped"] = frameStreamDropped();
+
+    metricsDoc["nvs_writes"] = counters[METRIC_NVS_WRITES].load(std::memory_order_relaxed);
+
+    // Bytes of stack that have never been touched
+    JsonObject stack = metricsDoc.createNestedObject("stack");
+    stack["short"] = stackHighWater(processShortTaskHandle);
+    stack["long"] = stackHighWater(processLongTaskHandle);
+    stack["render"] = stackHighWater(renderTaskHandle);
+    stack["mqtt"] = stackHighWater(mqttTask);
+
+    length = serializeJson(metricsDoc, metricsOutput, sizeof(metricsOutput));
+    esp_mqtt_client_publish(mqttClient, PUB_METRICS, metricsOutput, length, 0, 0);
+#endif
+}
@@ -3,7 +3,6 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/semphr.h"
 #include "freertos/queue.h"
 
 #include <Arduino.h>
@@ -11,98 +10,308 @@
 #include <ArduinoJson.h>
 #include <Adafruit_NeoPixel.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <mqtt_client.h>
+#include <ctype.h>
 
+#include "actionQueue.h"
+#include "benchmark.h"
+#include "effectProgram.h"
+#include "frameStream.h"
 #include "log.h"
 #include "led.h"
+#include "memoryAudit.h"
+#include "metrics.h"
 #include "mqttEventProcessing.h"
+#include "mqttRouter.h"
 #include "neoPixelRing.h"
+#include "network.h"
+#include "render.h"
+#include "renderChannel.h"
+#include "ringState.h"
+#include "stateStore.h"
+#include "statusPublisher.h"
+#include "timeSync.h"
+#include "trace.h"
+
+// esp-mqtt splits any packet bigger than its buffer over several events, and a
+// publish carries up to 5 bytes of fixed header, the topic and a packet id on
+// top of the payload. Split frames are rejected, so the longest segment's
+// frame has to fit in one go.
+#if defined(SUB_STREAM)
+static_assert(STREAM_FRAME_MAX_LEN + SEGMENT_TOPIC_LEN + 9 <= MQTT_BUFFER_SIZE,
+    "MQTT_BUFFER_SIZE is too small for a stream frame of the longest segment");
+#endif
 
 //==============================================================================
 // Helpers
 
-static SubsctiptionActionType_t getActionType(esp_mqtt_event_handle_t event)
+// Indexed by RingEffect_t
+static const char *effectNames[RING_EFFECT_COUNT] = {"none", "fade", "wipe", "rainbow", "rainbow_cycle", "program"};
+
+static void clearAction(SubscriptionAction_t *action)
 {
-    if (strncmp(SUB_SET_COLOR, event->topic, event->topic_len) == 0) {
-        return SET_COLOR;
-    }
+    memset(action, 0, sizeof(SubscriptionAction_t));
+}
 
-    if (strncmp(SUB_GET_COLOR, event->topic, event->topic_len) == 0) {
-        return GET_COLOR;
-    }
+// Rainbow steps are held for a whole number of render frames
+static uint8_t effectWait(uint16_t time)
+{
+    uint32_t frames = ((uint32_t)time * FADE_TIME_UNIT_MS) / RENDER_FRAME_MS;
 
-    return UNKNOWN;
+    return frames < 1 ? 1 : (frames > 255 ? 255 : (uint8_t)frames);
 }
 
+static bool parseEffect(uint8_t *effect, const char *name)
+{
+    uint8_t i;
 
-static bool isShortTask(SubsctiptionActionType_t type) {
-    if (type == GET_COLOR) {
-        return true;
+    for (i = 0; i < RING_EFFECT_COUNT; i++) {
+        if (strcmp(name, effectNames[i]) == 0) {
+            *effect = i;
+            return true;
+        }
     }
 
+    APP_LOG(F("unknown effect"));
     return false;
 }
 
-static bool isLongTask(SubsctiptionActionType_t type)
+// Works out when a scene's "at" is on the esp_timer clock, see ColorCommand_t
+static bool parseStartAt(uint32_t *startAt, uint64_t at)
 {
-    if (type == SET_COLOR) {
+    int64_t now = esp_timer_get_time();
+    int64_t start;
+
+    *startAt = 0;
+    if (!at) {
         return true;
     }
 
-    return false;
+    if (!wallTimeToTimer(at, &start)) {
+        APP_LOG(F("the clock isn't synced yet, starting the scene straight away"));
+        return true;
+    }
+
+    if (start <= now) {
+        return true;
+    }
+
+    if (start - now > (int64_t)SCENE_MAX_DELAY_MS * 1000) {
+        APP_LOG(F("the scene starts too far ahead"));
+        return false;
+    }
+
+    // 0 means straight away, a microsecond late doesn't matter
+    *startAt = (uint32_t)start ? (uint32_t)start : 1;
+
+    return true;
 }
 
-static void clearAction(SubscriptionAction_t *action)
+// The fields of a SET_COLOR (and of every step of a sequence)
+static bool parseColorFields(ColorCommand_t *command, JsonObject json)
+{
+    const char *effect;
+
+    command->color.r = json["r"].as<uint8_t>();
+    command->color.g = json["g"].as<uint8_t>();
+    command->color.b = json["b"].as<uint8_t>();
+    command->time = json["time"].as<uint16_t>();
+    command->effect = command->time ? EFFECT_FADE : EFFECT_NONE;
+
+    effect = json["effect"];
+    if (effect && !parseEffect(&command->effect, effect)) {
+        return false;
+    }
+
+    return true;
+}
+
+// Decodes a SET_COLOR payload, e.g. {"r": 255, "g": 0, "b": 0, "time": 100}
+static bool parseColorCommand(ColorCommand_t *command, uint32_t *startAt, esp_mqtt_event_handle_t event)
+{
+    StaticJsonDocument<SET_COLOR_JSON_CAPACITY> doc;
+    DeserializationError error = deserializeJson(doc, (const char *)event->data, event->data_len);
+    JsonObject json;
+
+    if (error) {
+        APP_LOG(&error);
+        return false;
+    }
+
+    json = doc.as<JsonObject>();
+    if (!parseColorFields(command, json)) {
+        return false;
+    }
+
+    return parseStartAt(startAt, json["at"].as<uint64_t>());
+}
+
+// Decodes a binary SET_COLOR payload, see mqttEventProcessing.h for the layout
+static bool parseBinaryColorCommand(ColorCommand_t *command, esp_mqtt_event_handle_t event)
+{
+    const uint8_t *data = (const uint8_t *)event->data;
+
+    if (event->data_len != BINARY_COLOR_LEN && event->data_len != BINARY_COLOR_TIME_LEN && event->data_len != BINARY_COLOR_EFFECT_LEN) {
+        APP_LOG(F("binary color payload has the wrong length"));
+        return false;
+    }
+
+    command->color.r = data[0];
+    command->color.g = data[1];
+    command->color.b = data[2];
+    command->time = (event->data_len >= BINARY_COLOR_TIME_LEN) ? (uint16_t)((data[3] << 8) | data[4]) : 0;
+    command->effect = command->time ? EFFECT_FADE : EFFECT_NONE;
+
+    if (event->data_len == BINARY_COLOR_EFFECT_LEN) {
+        if (data[5] >= RING_EFFECT_COUNT) {
+            APP_LOG(F("unknown effect"));
+            return false;
+        }
+        command->effect = data[5];
+    }
+
+    return true;
+}
+
+// A SET_COLOR that's a list of steps, see ColorSequence_t
+static bool isColorSequence(PayloadFormat_t format, esp_mqtt_event_handle_t event)
+{
+    int i = 0;
+
+    if (format == PAYLOAD_BINARY) {
+        return event->data_len >= BINARY_COLOR_STEP_LEN && event->data_len % BINARY_COLOR_STEP_LEN == 0;
+    }
+
+    while (i < event->data_len && isspace((unsigned char)event->data[i])) {
+        i++;
+    }
+
+    return i < event->data_len && event->data[i] == '[';
+}
+
+// Too big for the mqtt task's stack, and only the mqtt task parses sequences
+static StaticJsonDocument<COLOR_SEQUENCE_JSON_CAPACITY> sequenceDoc;
+
+AUDIT_STATIC("sequence", sequenceDoc);
+
+static bool parseColorSequence(ColorSequence_t *sequence, esp_mqtt_event_handle_t event)
+{
+    ColorStep_t *parsed;
+    JsonArray steps;
+
+    if (event->data_len > COLOR_SEQUENCE_JSON_LEN) {
+        APP_LOG(F("sequence is to long"));
+        return false;
+    }
+
+    DeserializationError error = deserializeJson(sequenceDoc, (const char *)event->data, event->data_len);
+    if (error) {
+        APP_LOG(&error);
+        return false;
+    }
+
+    steps = sequenceDoc.as<JsonArray>();
+    if (steps.size() == 0 || steps.size() > COLOR_SEQUENCE_MAX_STEPS) {
+        APP_LOG(F("sequence needs 1 - 16 steps"));
+        return false;
+    }
+
+    sequence->count = 0;
+    for (JsonVariant step : steps) {
+        parsed = &sequence->steps[sequence->count++];
+        if (!parseColorFields(&parsed->command, step.as<JsonObject>())) {
+            return false;
+        }
+        parsed->hold = step["hold"].as<uint16_t>();
+    }
+
+    return true;
+}
+
+static bool parseBinaryColorSequence(ColorSequence_t *sequence, esp_mqtt_event_handle_t event)
 {
-    action->client = NULL;
-    action->type = UNKNOWN;
-    memset(action->data, '\0', SUBSCRIPTIONDATALEN);
-    action->dataLength = 0;
+    const uint8_t *data = (const uint8_t *)event->data;
+    uint8_t count = event->data_len / BINARY_COLOR_STEP_LEN;
+    ColorStep_t *parsed;
+    uint8_t i;
+
+    if (event->data_len > COLOR_SEQUENCE_MAX_STEPS * BINARY_COLOR_STEP_LEN) {
+        APP_LOG(F("sequence needs 1 - 16 steps"));
+        return false;
+    }
+
+    for (i = 0; i < count; i++, data += BINARY_COLOR_STEP_LEN) {
+        if (data[5] >= RING_EFFECT_COUNT) {
+            APP_LOG(F("unknown effect"));
+            return false;
+        }
+
+        parsed = &sequence->steps[i];
+        parsed->command.color.r = data[0];
+        parsed->command.color.g = data[1];
+        parsed->command.color.b = data[2];
+        parsed->command.time = (uint16_t)((data[3] << 8) | data[4]);
+        parsed->command.effect = data[5];
+        parsed->hold = (uint16_t)((data[6] << 8) | data[7]);
+    }
+    sequence->count = count;
+
+    return true;
 }
 
-static void setAction(
+// Decodes a SET_BRIGHTNESS payload, e.g. {"brightness": 128}
+static bool parseBrightness(uint8_t *brightness, esp_mqtt_event_handle_t event)
+{
+    StaticJsonDocument<SET_BRIGHTNESS_JSON_CAPACITY> doc;
+    DeserializationError error = deserializeJson(doc, (const char *)event->data, event->data_len);
+
+    if (error) {
+        APP_LOG(&error);
+        return false;
+    }
+
+    *brightness = doc["brightness"].as<uint8_t>();
+
+    return true;
+}
+
+// The payload is decoded here, on the mqtt task, so only the compact command
+// gets queued and malformed payloads never take up a queue slot.
+static bool setAction(
     SubscriptionAction_t *action,
     SubsctiptionActionType_t type,
+    PayloadFormat_t format,
+    uint8_t segment,
     esp_mqtt_event_handle_t event
 ) {
     clearAction(action);
 
     if (SUBSCRIPTIONDATALEN < event->data_len) {
-        return;
+        APP_LOG(F("can't parse, data is to long..."));
+        return false;
     }
 
-    action->client = event->client;
-    action->type = type;
-    strncpy(action->data, (char *)event->data, event->data_len);
-    action->dataLength = event->data_len;
-}
-
-//==============================================================================
-// Mqtt publish functions
-
-void publishRgbStatus(void)
-{
-    APP_LOG(F("publishRgbStatus()"));
+    if (type == SET_COLOR) {
+        bool parsed = (format == PAYLOAD_BINARY)
+            ? parseBinaryColorCommand(&action->command, event)
+            : parseColorCommand(&action->command, &action->startAt, event);
 
-    char output[SUBSCRIPTIONDATALEN];
-    const int capacity = JSON_OBJECT_SIZE(3);
-    StaticJsonDocument<capacity> doc;
-    RGB_t color = {0, 0, 0};
+        if (!parsed) {
+            return false;
+        }
+    }
 
-    if (xSemaphoreTake(ringMutex, 0) == pdTRUE) {
-        ring.getColor(&color);
-        xSemaphoreGive(ringMutex);
-    } else {
-        APP_LOG(F("the ring is already taken"));
-        return;
+    if (type == SET_BRIGHTNESS && !parseBrightness(&action->brightness, event)) {
+        return false;
     }
 
-    doc["r"] = color.r;
-    doc["g"] = color.g;
-    doc["b"] = color.b;
+    action->type = type;
+    action->format = format;
+    action->segment = segment;
+    action->enqueuedAt = (uint32_t)esp_timer_get_time();
 
-    serializeJson(doc, output, sizeof(output));
-    esp_mqtt_client_publish(mqttClient, PUB_GET_COLOR, output, 0, 0, 0);
+    return true;
 }
 
 //==============================================================================
@@ -112,74 +321,274 @@ void getColor(SubscriptionAction_t *action)
 {
     APP_LOG(F("getColor()"));
 
-    if (SUBSCRIPTIONDATALEN < action->dataLength) {
-        APP_LOG(F("can't parse, data is to long..."));
-        return;
+    // Whoever asked gets an answer, even if the status hasn't changed
+    scheduleRgbStatus(action->segment, action->format, true);
+}
+
+// Also used at boot, to replay the stored command
+bool applyColorCommand(NeoPixelRing *ring, const ColorCommand_t *command)
+{
+    const RGB_t *color = &command->color;
+
+    switch (command->effect) {
+        case EFFECT_FADE:
+            ring->fadeColor(color->r, color->g, color->b, (uint32_t)command->time * FADE_TIME_UNIT_MS);
+            break;
+        case EFFECT_WIPE:
+            ring->wipeColor(color->r, color->g, color->b);
+            break;
+        case EFFECT_RAINBOW:
+            ring->rainbow(effectWait(command->time));
+            break;
+        case EFFECT_RAINBOW_CYCLE:
+            ring->rainbowCycle(effectWait(command->time));
+            break;
+        case EFFECT_PROGRAM:
+            ring->runProgram(NULL);
+            break;
+        default:
+            ring->setColor(color->r, color->g, color->b);
+            break;
     }
 
-    publishRgbStatus();
+    return ring->isAnimating();
 }
 
 void setColor(SubscriptionAction_t *action)
 {
     APP_LOG(F("setColor()"));
 
-    if (SUBSCRIPTIONDATALEN < action->dataLength) {
-        APP_LOG(F("can't parse, data is to long..."));
+    RenderCommand_t command;
+
+    setRgbStatusFormat(action->format);
+
+    // The render task plays out the effect and publishes the status once it's shown
+    command.type = RENDER_SET_COLOR;
+    command.segment = action->segment;
+    command.enqueuedAt = action->enqueuedAt;
+    command.startAt = action->startAt;
+    command.command = action->command;
+    sendRenderCommand(RENDER_FROM_LONG, &command);
+
+    storeColorCommand(action->segment, &action->command);
+}
+
+void setBrightness(SubscriptionAction_t *action)
+{
+    APP_LOG(F("setBrightness()"));
+
+    RenderCommand_t command;
+
+    command.type = RENDER_SET_BRIGHTNESS;
+    command.segment = action->segment;
+    command.enqueuedAt = action->enqueuedAt;
+    command.startAt = 0;
+    command.brightness = action->brightness;
+    sendRenderCommand(RENDER_FROM_SHORT, &command);
+
+    storeBrightness(action->segment, action->brightness);
+
+    // The status is built from the ring's snapshot, so wait for the render
+    // task to apply the brightness first. That's at most a frame.
+    syncRenderCommands(RENDER_FROM_SHORT);
+    scheduleRgbStatus(action->segment, action->format, false);
+}
+
+#if defined(SUB_SET_EFFECT)
+// Mqtt task only. A descriptor is too big for an action, so it's parsed and
+// handed to the render task right here instead of being queued.
+static void loadEffect(esp_mqtt_event_handle_t event, uint8_t first, uint8_t last)
+{
+    APP_LOG(F("loadEffect()"));
+
+    static EffectProgram_t program;
+    RenderCommand_t render;
+    ColorCommand_t command;
+    EffectLayer_t layer;
+    uint8_t segment;
+
+    if (!parseEffectProgram(&program, &layer, (const char *)event->data, event->data_len)) {
+        metricsCount(METRIC_REJECTED);
         return;
     }
 
-    const int capacity = JSON_OBJECT_SIZE(4);
-    StaticJsonDocument<capacity> doc;
-    DeserializationError error = deserializeJson(doc, action->data);
+    // The ring copies the program, so it only has to outlive the sync
+    memset(&render, 0, sizeof(RenderCommand_t));
+    render.enqueuedAt = (uint32_t)esp_timer_get_time();
+    if (layer.layer) {
+        render.type = RENDER_RUN_LAYER;
+        render.layer.program = &program;
+        render.layer.settings = layer;
+    } else {
+        render.type = RENDER_RUN_PROGRAM;
+        render.program = &program;
+    }
+    for (segment = first; segment <= last; segment++) {
+        render.segment = segment;
+        sendRenderCommand(RENDER_FROM_MQTT, &render);
+    }
+    syncRenderCommands(RENDER_FROM_MQTT);
 
-    if (error) {
-        APP_LOG(&error);
+    // Layers are transient, only the ring's own effect comes back after a reboot
+    if (layer.layer) {
         return;
     }
 
-    uint8_t r = doc["r"].as<uint8_t>();
-    uint8_t g = doc["g"].as<uint8_t>();
-    uint8_t b = doc["b"].as<uint8_t>();
-    uint16_t time = doc["time"].as<uint16_t>();
+    memset(&command, 0, sizeof(ColorCommand_t));
+    command.effect = EFFECT_PROGRAM;
+    for (segment = first; segment <= last; segment++) {
+        storeEffectProgram(segment, &program);
+        storeColorCommand(segment, &command);
+    }
+}
+#endif
 
-    if (xSemaphoreTake(ringMutex, 0) == pdTRUE) {
-        if (time) {
-            ring.fadeColor(r, g, b, time);
-        } else {
-            ring.setColor(r, g, b);
-        }
-        xSemaphoreGive(ringMutex);
-    } else {
-        APP_LOG(F("the ring is already taken"));
+// Mqtt task only, like loadEffect(). The steps are parsed in one go and the
+// render task plays them back to back.
+static void loadSequence(esp_mqtt_event_handle_t event, PayloadFormat_t format, uint8_t first, uint8_t last)
+{
+    APP_LOG(F("loadSequence()"));
+
+    static ColorSequence_t sequence;
+    RenderCommand_t render;
+    uint8_t segment;
+    bool parsed = (format == PAYLOAD_BINARY)
+        ? parseBinaryColorSequence(&sequence, event)
+        : parseColorSequence(&sequence, event);
+
+    if (!parsed) {
+        metricsCount(METRIC_REJECTED);
+        return;
+    }
+
+    setRgbStatusFormat(format);
+
+    // The render task copies the sequence, so it only has to outlive the sync
+    memset(&render, 0, sizeof(RenderCommand_t));
+    render.type = RENDER_RUN_SEQUENCE;
+    render.enqueuedAt = (uint32_t)esp_timer_get_time();
+    render.sequence = &sequence;
+    for (segment = first; segment <= last; segment++) {
+        render.segment = segment;
+        sendRenderCommand(RENDER_FROM_MQTT, &render);
     }
+    syncRenderCommands(RENDER_FROM_MQTT);
 
-    publishRgbStatus();
+    // Where it ends up is what comes back after a reboot
+    for (segment = first; segment <= last; segment++) {
+        storeColorCommand(segment, &sequence.steps[sequence.count - 1].command);
+    }
 }
 
 //==============================================================================
 // Process Tasks
 
-void processShortTask(void *parameter)
+// The process tasks block on their queue, so they wake as soon as an action
+// is sent and drain everything that is queued before going back to sleep.
+// The per-action handlers are split out so the bench can drive them without
+// a scheduler.
+
+void processShortAction(SubscriptionAction_t *action)
 {
-    SubscriptionAction_t action;
+    APP_LOG(F("processShortTask()"));
+    APP_LOG(action);
+    ACTION_LATENCY_LOG(action);
+    metricsQueueLatency(action->enqueuedAt);
+    TRACE(TRACE_ACTION_START, action->type);
+
+    switch(action->type) {
+        case GET_COLOR:
+            getColor(action);
+            break;
+        case SET_BRIGHTNESS:
+            setBrightness(action);
+            break;
+#if defined(APP_TRACE) && APP_TRACE
+        case DUMP_TRACE:
+            publishTrace();
+            break;
+#endif
+#if defined(APP_BENCHMARK) && APP_BENCHMARK
+        case RUN_BENCHMARK:
+            runBenchmark();
+            break;
+#endif
+#if defined(APP_MEMORY_AUDIT) && APP_MEMORY_AUDIT
+        case DUMP_MEMORY_AUDIT:
+            publishMemoryAudit();
+            break;
+#endif
+        default:
+            break;
+    }
 
-    while (1) {
-        if (xQueueReceive(shortActionQueue, &action, 0) == pdTRUE) {
-            APP_LOG(F("processShortTask()"));
-            APP_LOG(&action);
+    TRACE(TRACE_ACTION_END, action->type);
+}
+
+void processLongAction(SubscriptionAction_t *action)
+{
+    APP_LOG(F("processLongTask()"));
+    APP_LOG(action);
+    ACTION_LATENCY_LOG(action);
+    metricsQueueLatency(action->enqueuedAt);
+    TRACE(TRACE_ACTION_START, action->type);
+
+    switch(action->type) {
+        case SET_COLOR:
+            setColor(action);
+            break;
+        default:
+            break;
+    }
 
+    TRACE(TRACE_ACTION_END, action->type);
+}
 
-            switch(action.type) {
-                case GET_COLOR:
-                    getColor(&action);
-                    break;
-            }
+// Everything the timers and the render task raised since the last call
+void processShortSignals(void)
+{
+    uint32_t signals = takeShortSignals();
+    uint8_t segment;
+
+    if (!signals) {
+        return;
+    }
+
+    for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+        if (signals & SIGNAL_PUBLISH_STATUS_FOR(segment)) {
+            scheduleQueuedRgbStatus(segment);
+        }
+    }
+    if (signals & SIGNAL_FLUSH_STATUS) {
+        flushRgbStatus();
+    }
+    if (signals & SIGNAL_PUBLISH_METRICS) {
+        publishMetrics();
+    }
+    if (signals & SIGNAL_STORE_STATE) {
+        flushStoredState();
+    }
+    if (signals & SIGNAL_RECONNECT_MQTT) {
+        reconnectMqtt();
+    }
+}
+
+// Sleeps on its notification, which queueShortAction() and signalShortTask()
+// both give. syncRenderCommands() waits on the same notification and can
+// take a wake meant for this loop, but it only runs from an action, and the
+// queue and the signals are looked at again after every action.
+void processShortTask(void *parameter)
+{
+    SubscriptionAction_t action;
 
-            clearAction(&action);
+    while (1) {
+        processShortSignals();
+        while (xQueueReceive(shortActionQueue, &action, 0) == pdTRUE) {
+            processShortAction(&action);
+            processShortSignals();
         }
 
-        vTaskDelay(250 / portTICK_PERIOD_MS);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
 }
 
@@ -188,37 +597,64 @@ void processLongTask(void *parameter)
     SubscriptionAction_t action;
 
     while (1) {
-        if (xQueueReceive(longActionQueue, &action, 0) == pdTRUE) {
-            APP_LOG(F("processLongTask()"));
-            APP_LOG(&action);
-
-            switch(action.type) {
-                case SET_COLOR:
-                    setColor(&action);
-                    break;
-            }
-
-            clearAction(&action);
+        if (xQueueReceive(longActionQueue, &action, portMAX_DELAY) == pdTRUE) {
+            processLongAction(&action);
         }
-
-        vTaskDelay(50 / portTICK_PERIOD_MS);
     }
 }
 
 //==============================================================================
 // Mqtt event functions
 
-static void mqtt_unsubscribe_all(esp_mqtt_client_handle_t client)
+// (Un)subscribes every topic the routes answer on, one per segment for
+// segmented routes and one per group
+static void mqtt_route_topics(esp_mqtt_client_handle_t client, bool subscribe)
 {
-    esp_mqtt_client_unsubscribe(client, SUB_GET_COLOR);
-    esp_mqtt_client_unsubscribe(client, SUB_SET_COLOR);
+    const MqttRoute_t *route = NULL;
+    char topic[SEGMENT_TOPIC_LEN];
+    uint8_t i, segment;
+    int length;
+
+    for (i = 0; i < getMqttRouteCount(); i++) {
+        route = getMqttRoute(i);
+        if (!route->topicLength) {
+            continue;
+        }
+
+        for (segment = 0; segment < (route->segmented ? SEGMENT_COUNT : 1); segment++) {
+            if (!segmentTopic(topic, route->topic, segment)) {
+                APP_LOGF("topic \"%s\" is too long for segment %u\n", route->topic, segment);
+                continue;
+            }
+
+            if (subscribe) {
+                esp_mqtt_client_subscribe(client, topic, QOS_AT_MOST_ONCE);
+            } else {
+                esp_mqtt_client_unsubscribe(client, topic);
+            }
+        }
+    }
+
+    // One wildcard per group covers every route under it
+    for (i = 0; i < getMqttGroupCount(); i++) {
+        length = snprintf(topic, sizeof(topic), "%s/#", getMqttGroup(i));
+        if (length <= 0 || length >= (int)sizeof(topic)) {
+            APP_LOGF("group \"%s\" is too long\n", getMqttGroup(i));
+            continue;
+        }
+
+        if (subscribe) {
+            esp_mqtt_client_subscribe(client, topic, QOS_AT_MOST_ONCE);
+        } else {
+            esp_mqtt_client_unsubscribe(client, topic);
+        }
+    }
 }
 
 static void mqtt_subsribe_all(esp_mqtt_client_handle_t client)
 {
-    mqtt_unsubscribe_all(client);
-    esp_mqtt_client_subscribe(client, SUB_GET_COLOR, QOS_AT_MOST_ONCE);
-    esp_mqtt_client_subscribe(client, SUB_SET_COLOR, QOS_AT_MOST_ONCE);
+    mqtt_route_topics(client, false);
+    mqtt_route_topics(client, true);
 }
 
 static void mqtt_handle_data_event(esp_mqtt_event_handle_t event)
@@ -227,20 +663,60 @@ static void mqtt_handle_data_event(esp_mqtt_event_handle_t event)
     APP_LOG(event);
 
     SubscriptionAction_t action;
-    SubsctiptionActionType_t actionType = getActionType(event);
+    uint8_t segment;
+    const MqttRoute_t *route = findMqttRoute(event->topic, event->topic_len, &segment);
+    uint8_t first = (segment == SEGMENT_ALL) ? 0 : segment;
+    uint8_t last = (segment == SEGMENT_ALL) ? SEGMENT_COUNT - 1 : segment;
 
-    if (isShortTask(actionType)) {
-        setAction(&action, actionType, event);
-        if (action.type != UNKNOWN && action.client != NULL) {
-            xQueueSend(shortActionQueue, &action, portMAX_DELAY);
-        }
-    } else if (isLongTask(actionType)) {
-        setAction(&action, actionType, event);
-        if (action.type != UNKNOWN && action.client != NULL) {
-            xQueueSend(longActionQueue, &action, portMAX_DELAY);
-        }
-    } else {
+    if (!route) {
         APP_LOG(F("Topic was unhandled"));
+        return;
+    }
+
+    switch (route->queue) {
+        case QUEUE_INLINE:
+            if (route->type == STREAM_FRAME) {
+                // With the static_assert above only payloads longer than any
+                // frame get split, count them once on the first event
+                if (event->current_data_offset != 0 || event->data_len != event->total_data_len) {
+                    if (event->current_data_offset == 0) {
+                        APP_LOG(F("stream frame split over several events, rejected"));
+                        metricsCount(METRIC_REJECTED);
+                    }
+                } else if (!frameStreamWrite(segment, (const uint8_t *)event->data, event->data_len)) {
+                    metricsCount(METRIC_REJECTED);
+                }
+            }
+#if defined(SUB_SET_EFFECT)
+            if (route->type == LOAD_EFFECT && event->current_data_offset == 0 && event->data_len == event->total_data_len) {
+                loadEffect(event, first, last);
+            }
+#endif
+            break;
+        case QUEUE_SHORT:
+        case QUEUE_LONG:
+            if (route->type == SET_COLOR && isColorSequence(route->format, event)) {
+                if (event->current_data_offset == 0 && event->data_len == event->total_data_len) {
+                    loadSequence(event, route->format, first, last);
+                }
+                break;
+            }
+
+            if (!setAction(&action, route->type, route->format, first, event)) {
+                metricsCount(METRIC_REJECTED);
+                break;
+            }
+
+            // A group message is parsed once and queued for every segment
+            for (segment = first; segment <= last; segment++) {
+                action.segment = segment;
+                if (route->queue == QUEUE_SHORT) {
+                    queueShortAction(&action);
+                } else {
+                    queueLongAction(&action);
+                }
+            }
+            break;
     }
 }
 
@@ -252,7 +728,11 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
     switch ((esp_mqtt_event_id_t)event_id) {
         case MQTT_EVENT_CONNECTED:
             MQTT_EVENT_LOG(F("MQTT_EVENT_CONNECTED"));
-            mqtt_subsribe_all(client);
+            metricsSetMqttTask(xTaskGetCurrentTaskHandle());
+            // The broker kept our subscriptions, see MQTT_PERSISTENT_SESSION
+            if (!event->session_present) {
+                mqtt_subsribe_all(client);
+            }
             break;
         case MQTT_EVENT_DISCONNECTED:
             MQTT_EVENT_LOG(F("MQTT_EVENT_DISCONNECTED"));
@@ -267,6 +747,7 @@ void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event
             MQTT_EVENT_LOGF("MQTT_EVENT_PUBLISHED, msg_id=%d\n", event->msg_id);
             break;
         case MQTT_EVENT_DATA:
+            TRACE(TRACE_MQTT_DATA, event->data_len);
             mqtt_handle_data_event(event);
             break;
         case MQTT_EVENT_ERROR:
@@ -0,0 +1,242 @@
+#include "config.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+
+#include "benchmark.h"
+#include "log.h"
+#include "memoryAudit.h"
+#include "mqttEventProcessing.h"
+#include "mqttRouter.h"
+#include "segment.h"
+#include "trace.h"
+
+//==============================================================================
+// Routes
+
+// Every topic the dino subscribes to. Topics that aren't configured (empty
+// strings) are left out of the table. Streams aren't grouped, every dino's
+// frame is a different length.
+static MqttRoute_t routes[] = {
+    {SUB_GET_COLOR, GET_COLOR, PAYLOAD_JSON, QUEUE_SHORT, true, true, 0, 0},
+    {SUB_SET_COLOR, SET_COLOR, PAYLOAD_JSON, QUEUE_LONG, true, true, 0, 0},
+#if defined(SUB_SET_BRIGHTNESS)
+    {SUB_SET_BRIGHTNESS, SET_BRIGHTNESS, PAYLOAD_JSON, QUEUE_SHORT, true, true, 0, 0},
+#endif
+#if defined(SUB_GET_COLOR_BIN)
+    {SUB_GET_COLOR_BIN, GET_COLOR, PAYLOAD_BINARY, QUEUE_SHORT, true, true, 0, 0},
+#endif
+#if defined(SUB_SET_COLOR_BIN)
+    {SUB_SET_COLOR_BIN, SET_COLOR, PAYLOAD_BINARY, QUEUE_LONG, true, true, 0, 0},
+#endif
+#if defined(APP_TRACE) && APP_TRACE
+    {SUB_TRACE_DUMP, DUMP_TRACE, PAYLOAD_BINARY, QUEUE_SHORT, false, false, 0, 0},
+#endif
+#if defined(APP_BENCHMARK) && APP_BENCHMARK
+    {SUB_BENCHMARK, RUN_BENCHMARK, PAYLOAD_BINARY, QUEUE_SHORT, false, false, 0, 0},
+#endif
+#if defined(APP_MEMORY_AUDIT) && APP_MEMORY_AUDIT
+    {SUB_MEMORY_AUDIT, DUMP_MEMORY_AUDIT, PAYLOAD_BINARY, QUEUE_SHORT, false, false, 0, 0},
+#endif
+#if defined(SUB_SET_EFFECT)
+    {SUB_SET_EFFECT, LOAD_EFFECT, PAYLOAD_JSON, QUEUE_INLINE, true, true, 0, 0},
+#endif
+#if defined(SUB_STREAM)
+    {SUB_STREAM, STREAM_FRAME, PAYLOAD_BINARY, QUEUE_INLINE, true, false, 0, 0},
+#endif
+};
+
+#define MQTT_ROUTE_COUNT (sizeof(routes) / sizeof(routes[0]))
+
+static_assert(MQTT_ROUTE_COUNT < MQTT_ROUTE_TABLE_SIZE, "MQTT_ROUTE_TABLE_SIZE needs at least one empty slot");
+
+// Index + 1 into `routes`, 0 is an empty slot
+static uint8_t routeTable[MQTT_ROUTE_TABLE_SIZE];
+
+AUDIT_STATIC("router", routes);
+AUDIT_STATIC("router", routeTable);
+
+#if defined(MQTT_GROUPS_ENABLED)
+static const char *groups[] = {MQTT_GROUP_TOPICS};
+#define MQTT_GROUP_COUNT (sizeof(groups) / sizeof(groups[0]))
+static uint16_t groupLengths[MQTT_GROUP_COUNT];
+#else
+#define MQTT_GROUP_COUNT 0
+#endif
+
+//==============================================================================
+// Helpers
+
+// FNV-1a
+static uint32_t hashTopic(const char *topic, int topicLength)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < topicLength; i++) {
+        hash ^= (uint8_t)topic[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static const MqttRoute_t *findRoute(const char *topic, int topicLength)
+{
+    uint32_t hash = hashTopic(topic, topicLength);
+    uint8_t slot = hash & (MQTT_ROUTE_TABLE_SIZE - 1);
+    const MqttRoute_t *route = NULL;
+
+    while (routeTable[slot]) {
+        route = &routes[routeTable[slot] - 1];
+        if (route->hash == hash && route->topicLength == topicLength && memcmp(route->topic, topic, topicLength) == 0) {
+            return route;
+        }
+
+        slot = (slot + 1) & (MQTT_ROUTE_TABLE_SIZE - 1);
+    }
+
+    return NULL;
+}
+
+//==============================================================================
+// Router functions
+
+void initMqttRoutes(void)
+{
+    uint8_t i, slot;
+
+    memset(routeTable, 0, sizeof(routeTable));
+
+    for (i = 0; i < MQTT_ROUTE_COUNT; i++) {
+        routes[i].topicLength = strlen(routes[i].topic);
+        routes[i].hash = hashTopic(routes[i].topic, routes[i].topicLength);
+
+        if (routes[i].topicLength == 0) {
+            continue;
+        }
+
+        if (findRoute(routes[i].topic, routes[i].topicLength)) {
+            APP_LOGF("topic \"%s\" is configured twice, only the first one is routed\n", routes[i].topic);
+            continue;
+        }
+
+        // Linear probing
+        slot = routes[i].hash & (MQTT_ROUTE_TABLE_SIZE - 1);
+        while (routeTable[slot]) {
+            slot = (slot + 1) & (MQTT_ROUTE_TABLE_SIZE - 1);
+        }
+
+        routeTable[slot] = i + 1;
+    }
+
+#if defined(MQTT_GROUPS_ENABLED)
+    for (i = 0; i < MQTT_GROUP_COUNT; i++) {
+        groupLengths[i] = strlen(groups[i]);
+    }
+#endif
+}
+
+// A topic with a segment on the end
+static const MqttRoute_t *findSegmentRoute(const char *topic, int topicLength, uint8_t *segment)
+{
+    const MqttRoute_t *route = NULL;
+    uint16_t baseLength;
+
+    if (SEGMENT_COUNT == 1) {
+        return NULL;
+    }
+
+    baseLength = parseSegmentTopic(topic, topicLength, segment);
+    route = baseLength ? findRoute(topic, baseLength) : NULL;
+
+    return (route && route->segmented) ? route : NULL;
+}
+
+#if defined(MQTT_GROUPS_ENABLED)
+// <group>/<topic>, only looked at once the topic didn't match on its own
+static const MqttRoute_t *findGroupRoute(const char *topic, int topicLength, uint8_t *segment)
+{
+    const MqttRoute_t *route = NULL;
+    const char *rest;
+    int restLength;
+    uint8_t i;
+
+    for (i = 0; i < MQTT_GROUP_COUNT; i++) {
+        if (topicLength <= groupLengths[i] + 1 || topic[groupLengths[i]] != '/'
+            || memcmp(topic, groups[i], groupLengths[i]) != 0) {
+            continue;
+        }
+
+        rest = topic + groupLengths[i] + 1;
+        restLength = topicLength - groupLengths[i] - 1;
+
+        route = findRoute(rest, restLength);
+        if (route) {
+            *segment = SEGMENT_ALL;
+        } else {
+            route = findSegmentRoute(rest, restLength, segment);
+        }
+
+        if (route && route->grouped) {
+            return route;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+const MqttRoute_t *findMqttRoute(const char *topic, int topicLength, uint8_t *segment)
+{
+    const MqttRoute_t *route = findRoute(topic, topicLength);
+
+    *segment = 0;
+    if (route) {
+        return route;
+    }
+
+    // Not one of the configured topics, it could still be one with a segment on the end
+    route = findSegmentRoute(topic, topicLength, segment);
+#if defined(MQTT_GROUPS_ENABLED)
+    if (!route) {
+        route = findGroupRoute(topic, topicLength, segment);
+    }
+#endif
+    if (!route) {
+        *segment = 0;
+    }
+
+    return route;
+}
+
+uint8_t getMqttRouteCount(void)
+{
+    return MQTT_ROUTE_COUNT;
+}
+
+// Routes for topics that aren't configured are still returned, with a topicLength of 0
+const MqttRoute_t *getMqttRoute(uint8_t index)
+{
+    if (index >= MQTT_ROUTE_COUNT) {
+        return NULL;
+    }
+
+    return &routes[index];
+}
+
+uint8_t getMqttGroupCount(void)
+{
+    return MQTT_GROUP_COUNT;
+}
+
+const char *getMqttGroup(uint8_t index)
+{
+#if defined(MQTT_GROUPS_ENABLED)
+    if (index < MQTT_GROUP_COUNT) {
+        return groups[index];
+    }
+#endif
+
+    return NULL;
+}
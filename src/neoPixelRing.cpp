@@ -1,66 +1,466 @@
 #include <Arduino.h>
 #include <HardwareSerial.h>
 #include <Adafruit_NeoPixel.h>
+#include <esp_timer.h>
 #include "led.h"
 #include "neoPixelRing.h"
+#include "trace.h"
+
+// Gamma 2.8, WS2812s are far from linear so without this a fade spends most of
+// its time looking nearly full on, and the low end steps visibly.
+static constexpr uint8_t gammaTable[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,   1,   1,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      2,   3,   3,   3,   3,   3,   3,   3,   4,   4,   4,   4,   4,   5,   5,   5,
+      5,   6,   6,   6,   6,   7,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,
+     10,  10,  11,  11,  11,  12,  12,  13,  13,  13,  14,  14,  15,  15,  16,  16,
+     17,  17,  18,  18,  19,  19,  20,  20,  21,  21,  22,  22,  23,  24,  24,  25,
+     25,  26,  27,  27,  28,  29,  29,  30,  31,  32,  32,  33,  34,  35,  35,  36,
+     37,  38,  39,  39,  40,  41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  50,
+     51,  52,  54,  55,  56,  57,  58,  59,  60,  61,  62,  63,  64,  66,  67,  68,
+     69,  70,  72,  73,  74,  75,  77,  78,  79,  81,  82,  83,  85,  86,  87,  89,
+     90,  92,  93,  95,  96,  98,  99, 101, 102, 104, 105, 107, 109, 110, 112, 114,
+    115, 117, 119, 120, 122, 124, 126, 127, 129, 131, 133, 135, 137, 138, 140, 142,
+    144, 146, 148, 150, 152, 154, 156, 158, 160, 162, 164, 167, 169, 171, 173, 175,
+    177, 180, 182, 184, 186, 189, 191, 193, 196, 198, 200, 203, 205, 208, 210, 213,
+    215, 218, 220, 223, 225, 228, 231, 233, 236, 239, 241, 244, 247, 249, 252, 255
+};
+
+// The color wheel, r -> g -> b -> back to r, packed as 0x00RRGGBB
+static constexpr uint32_t wheelTable[256] = {
+    0xFF0000, 0xFC0300, 0xF90600, 0xF60900, 0xF30C00, 0xF00F00, 0xED1200, 0xEA1500,
+    0xE71800, 0xE41B00, 0xE11E00, 0xDE2100, 0xDB2400, 0xD82700, 0xD52A00, 0xD22D00,
+    0xCF3000, 0xCC3300, 0xC93600, 0xC63900, 0xC33C00, 0xC03F00, 0xBD4200, 0xBA4500,
+    0xB74800, 0xB44B00, 0xB14E00, 0xAE5100, 0xAB5400, 0xA85700, 0xA55A00, 0xA25D00,
+    0x9F6000, 0x9C6300, 0x996600, 0x966900, 0x936C00, 0x906F00, 0x8D7200, 0x8A7500,
+    0x877800, 0x847B00, 0x817E00, 0x7E8100, 0x7B8400, 0x788700, 0x758A00, 0x728D00,
+    0x6F9000, 0x6C9300, 0x699600, 0x669900, 0x639C00, 0x609F00, 0x5DA200, 0x5AA500,
+    0x57A800, 0x54AB00, 0x51AE00, 0x4EB100, 0x4BB400, 0x48B700, 0x45BA00, 0x42BD00,
+    0x3FC000, 0x3CC300, 0x39C600, 0x36C900, 0x33CC00, 0x30CF00, 0x2DD200, 0x2AD500,
+    0x27D800, 0x24DB00, 0x21DE00, 0x1EE100, 0x1BE400, 0x18E700, 0x15EA00, 0x12ED00,
+    0x0FF000, 0x0CF300, 0x09F600, 0x06F900, 0x03FC00, 0x00FF00, 0x00FC03, 0x00F906,
+    0x00F609, 0x00F30C, 0x00F00F, 0x00ED12, 0x00EA15, 0x00E718, 0x00E41B, 0x00E11E,
+    0x00DE21, 0x00DB24, 0x00D827, 0x00D52A, 0x00D22D, 0x00CF30, 0x00CC33, 0x00C936,
+    0x00C639, 0x00C33C, 0x00C03F, 0x00BD42, 0x00BA45, 0x00B748, 0x00B44B, 0x00B14E,
+    0x00AE51, 0x00AB54, 0x00A857, 0x00A55A, 0x00A25D, 0x009F60, 0x009C63, 0x009966,
+    0x009669, 0x00936C, 0x00906F, 0x008D72, 0x008A75, 0x008778, 0x00847B, 0x00817E,
+    0x007E81, 0x007B84, 0x007887, 0x00758A, 0x00728D, 0x006F90, 0x006C93, 0x006996,
+    0x006699, 0x00639C, 0x00609F, 0x005DA2, 0x005AA5, 0x0057A8, 0x0054AB, 0x0051AE,
+    0x004EB1, 0x004BB4, 0x0048B7, 0x0045BA, 0x0042BD, 0x003FC0, 0x003CC3, 0x0039C6,
+    0x0036C9, 0x0033CC, 0x0030CF, 0x002DD2, 0x002AD5, 0x0027D8, 0x0024DB, 0x0021DE,
+    0x001EE1, 0x001BE4, 0x0018E7, 0x0015EA, 0x0012ED, 0x000FF0, 0x000CF3, 0x0009F6,
+    0x0006F9, 0x0003FC, 0x0000FF, 0x0300FC, 0x0600F9, 0x0900F6, 0x0C00F3, 0x0F00F0,
+    0x1200ED, 0x1500EA, 0x1800E7, 0x1B00E4, 0x1E00E1, 0x2100DE, 0x2400DB, 0x2700D8,
+    0x2A00D5, 0x2D00D2, 0x3000CF, 0x3300CC, 0x3600C9, 0x3900C6, 0x3C00C3, 0x3F00C0,
+    0x4200BD, 0x4500BA, 0x4800B7, 0x4B00B4, 0x4E00B1, 0x5100AE, 0x5400AB, 0x5700A8,
+    0x5A00A5, 0x5D00A2, 0x60009F, 0x63009C, 0x660099, 0x690096, 0x6C0093, 0x6F0090,
+    0x72008D, 0x75008A, 0x780087, 0x7B0084, 0x7E0081, 0x81007E, 0x84007B, 0x870078,
+    0x8A0075, 0x8D0072, 0x90006F, 0x93006C, 0x960069, 0x990066, 0x9C0063, 0x9F0060,
+    0xA2005D, 0xA5005A, 0xA80057, 0xAB0054, 0xAE0051, 0xB1004E, 0xB4004B, 0xB70048,
+    0xBA0045, 0xBD0042, 0xC0003F, 0xC3003C, 0xC60039, 0xC90036, 0xCC0033, 0xCF0030,
+    0xD2002D, 0xD5002A, 0xD80027, 0xDB0024, 0xDE0021, 0xE1001E, 0xE4001B, 0xE70018,
+    0xEA0015, 0xED0012, 0xF0000F, 0xF3000C, 0xF60009, 0xF90006, 0xFC0003, 0xFF0000
+};
+
+//-------------------------------
+// Helpers
+//-------------------------------
+
+// Where a program is in its current loop, in ms at the program's own speed.
+// Returns false once its last loop is done.
+static bool programPosition(const EffectProgram_t *program, int64_t now, int64_t *start, uint16_t *loopsPlayed, uint16_t *at)
+{
+    int64_t elapsed = now - *start;
+    uint16_t j;
+
+    // Rebasing every loop keeps the multiply below from overflowing
+    while (elapsed >= program->loopTime) {
+        *start += program->loopTime;
+        elapsed -= program->loopTime;
+        if (program->loops && ++(*loopsPlayed) >= program->loops) {
+            return false;
+        }
+    }
+
+    j = (uint16_t)(((uint64_t)elapsed * program->speedScale) >> 32);
+    *at = j < program->duration ? j : program->duration - 1;
+
+    return true;
+}
+
+// How far into the loop the pixel at `phase` around the ring is
+static uint16_t spreadOffset(const EffectProgram_t *program, uint16_t at, uint8_t phase)
+{
+    uint32_t offset = at + (((uint32_t)phase * program->spread * program->duration) >> 16);
+
+    return (uint16_t)(offset >= program->duration ? offset - program->duration : offset);
+}
+
+// One channel of a layer onto the channel underneath. alpha is 0 - 256, so a
+// fully opaque layer comes out exactly, with no division anywhere.
+static inline uint8_t blendChannel(EffectBlend_t blend, uint16_t alpha, uint8_t under, uint8_t over)
+{
+    uint16_t blended;
+
+    switch (blend) {
+        case BLEND_ADD:
+            blended = under + over;
+            if (blended > 255) {
+                blended = 255;
+            }
+            break;
+        case BLEND_MULTIPLY:
+            blended = (under * (over + 1)) >> 8;
+            break;
+        case BLEND_SCREEN:
+            blended = 255 - (((255 - under) * (256 - over)) >> 8);
+            break;
+        case BLEND_NORMAL:
+        default:
+            blended = over;
+            break;
+    }
+
+    return (uint8_t)((under * (256 - alpha) + blended * alpha) >> 8);
+}
 
 //-------------------------------
 // Constructor
 //-------------------------------
 NeoPixelRing::NeoPixelRing(Adafruit_NeoPixel *neoPixel):
-    neoPixel(neoPixel)
-{}
+    neoPixel(neoPixel),
+    output(NULL),
+    outputContext(NULL),
+    colors(NULL),
+    phases(NULL),
+    brightness(255),
+    gammaCorrection(true),
+    effect(EFFECT_NONE),
+    startColor({0, 0, 0}),
+    endColor({0, 0, 0}),
+    fadeDelta{0, 0, 0},
+    fadeStart(0),
+    fadeReciprocal(0),
+    program(),
+    programStart(0),
+    loopsPlayed(0),
+    frame(0),
+    frameCount(0),
+    frameInterval(1),
+    holdCount(0),
+    dirty(false),
+    layers(),
+    activeLayers(0),
+    composeDirty(false),
+    rawFrame(false),
+    framesShown(0),
+    framesSkipped(0)
+{
+    buildOutputTable();
+}
 
 //-------------------------------
 // Destructor
 //-------------------------------
-// TODO: if you ever allocate memory for anything in this class free it with this destructor
-// NeoPixelRing::~NeoPixelRing()
-// {}
+NeoPixelRing::~NeoPixelRing()
+{
+    delete[] colors;
+    delete[] phases;
+}
+
+//-------------------------------
+// private methods
+//-------------------------------
+// Goes back to the output table once a streamed frame is taken over
+void NeoPixelRing::endRawFrame(void)
+{
+    if (rawFrame) {
+        rawFrame = false;
+        composeDirty = true;
+    }
+}
+
+void NeoPixelRing::fill(uint8_t r, uint8_t g, uint8_t b)
+{
+    uint16_t i;
+
+    endRawFrame();
+    for (i = 0; i < neoPixel->numPixels(); i++) {
+        setPixel(i, neoPixel->Color(r, g, b));
+    }
+
+    show();
+}
+
+// Folds gamma and brightness into one table, so writing a pixel is three lookups
+void NeoPixelRing::buildOutputTable(void)
+{
+    uint16_t i;
+    for (i = 0; i < 256; i++) {
+        outputTable[i] = ((gammaCorrection ? gammaTable[i] : i) * (brightness + 1)) >> 8;
+    }
+}
+
+// Blends every layer over the ring's own colors, from the bottom up, into the
+// strip's buffer. With no layers up it's just the colors.
+void NeoPixelRing::compose(void)
+{
+    RingLayer_t *layer;
+    RGB_t over;
+    uint32_t color;
+    uint16_t i;
+    uint8_t r, g, b;
+    uint8_t l;
+
+    for (i = 0; i < neoPixel->numPixels(); i++) {
+        color = colors[i];
+        r = (uint8_t)(color >> 16);
+        g = (uint8_t)(color >> 8);
+        b = (uint8_t)color;
+
+        for (l = 0; l < EFFECT_MAX_LAYERS; l++) {
+            if (!(activeLayers & (1 << l))) {
+                continue;
+            }
+
+            layer = &layers[l];
+            if (layer->program.spread) {
+                sampleEffectProgram(&layer->program, spreadOffset(&layer->program, layer->at, phases[i]), &over);
+            } else {
+                over = layer->color;
+            }
+
+            r = blendChannel(layer->blend, layer->alpha, r, over.r);
+            g = blendChannel(layer->blend, layer->alpha, g, over.g);
+            b = blendChannel(layer->blend, layer->alpha, b, over.b);
+        }
+
+        writePixel(i, r, g, b);
+    }
+
+    composeDirty = false;
+    dirty = true;
+}
+
+// Writes every pixel back out through the output table, after it has changed
+void NeoPixelRing::refresh(void)
+{
+    compose();
+    show();
+}
+
+// Only touches the pixel, and marks the ring dirty, when the color changes.
+// `colors` keeps what was asked for, the neopixel buffer gets the corrected
+// output. With layers up the whole ring is blended again before the show.
+void NeoPixelRing::setPixel(uint16_t i, uint32_t color)
+{
+    if (colors[i] != color) {
+        colors[i] = color;
+        if (activeLayers) {
+            composeDirty = true;
+        } else {
+            writePixel(i, (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)color);
+        }
+        dirty = true;
+    }
+}
+
+// Skips pushing the frame out when nothing changed since the last one
+void NeoPixelRing::show(void)
+{
+    if (composeDirty) {
+        compose();
+    }
+
+    if (!dirty) {
+        framesSkipped++;
+        return;
+    }
+
+    TRACE(TRACE_SHOW, neoPixel->numPixels());
+    if (output) {
+        output(outputContext, neoPixel->getPixels(), neoPixel->numPixels() * 3);
+    } else {
+        neoPixel->show();
+    }
+    dirty = false;
+    framesShown++;
+}
+
+void NeoPixelRing::startEffect(RingEffect_t effect, uint16_t frameCount, uint8_t frameInterval)
+{
+    endRawFrame();
+    this->effect = effect;
+    this->frame = 0;
+    this->frameCount = frameCount;
+    this->frameInterval = frameInterval ? frameInterval : 1;
+    this->holdCount = 0;
+}
+
+// Moves every layer on to `now`, and takes off the ones that are done
+void NeoPixelRing::updateLayers(int64_t now)
+{
+    RingLayer_t *layer;
+    RGB_t color;
+    uint8_t l;
+
+    for (l = 0; l < EFFECT_MAX_LAYERS; l++) {
+        if (!(activeLayers & (1 << l))) {
+            continue;
+        }
+
+        layer = &layers[l];
+        if (!programPosition(&layer->program, now, &layer->programStart, &layer->loopsPlayed, &layer->at)) {
+            activeLayers &= ~(1 << l);
+            composeDirty = true;
+            continue;
+        }
+
+        // A spread layer is sampled per pixel, so it moves every frame
+        if (layer->program.spread) {
+            composeDirty = true;
+            continue;
+        }
+
+        sampleEffectProgram(&layer->program, layer->at, &color);
+        if (color.r != layer->color.r || color.g != layer->color.g || color.b != layer->color.b) {
+            layer->color = color;
+            composeDirty = true;
+        }
+    }
+}
+
+void NeoPixelRing::writePixel(uint16_t i, uint8_t r, uint8_t g, uint8_t b)
+{
+    if (rawFrame) {
+        neoPixel->setPixelColor(i, r, g, b);
+        return;
+    }
+
+    neoPixel->setPixelColor(i, outputTable[r], outputTable[g], outputTable[b]);
+}
 
 //-------------------------------
 // methods
 //-------------------------------
 void NeoPixelRing::begin(void)
 {
+    uint16_t i;
+
+    // The strip's length never changes, so calling begin() again keeps the buffers
+    if (!colors) {
+        colors = new uint32_t[neoPixel->numPixels()]();
+    }
+    if (!phases) {
+        phases = new uint8_t[neoPixel->numPixels()];
+        for (i = 0; i < neoPixel->numPixels(); i++) {
+            phases[i] = (uint8_t)((i * 256) / neoPixel->numPixels());
+        }
+    }
+
     neoPixel->begin();
+    dirty = true; // Whatever the pixels held before a reset is unknown, so always show the first frame
     off();
 }
 
-void NeoPixelRing::fadeColor(uint8_t r, uint8_t g, uint8_t b, uint16_t fadeTime)
+// Takes a layer off, the ring shows what's underneath again on the next frame
+void NeoPixelRing::clearLayer(uint8_t layer)
 {
-    RGB_t startColor = {0, 0, 0};
-    getColor(&startColor);
+    if (layer < 1 || layer > EFFECT_MAX_LAYERS || !(activeLayers & (1 << (layer - 1)))) {
+        return;
+    }
 
-    RGB_t color = {0, 0, 0};
-    for (int i = 0; i < fadeTime; i++) {
-        color.r = map(i, 0, fadeTime, startColor.r, r);
-        color.g = map(i, 0, fadeTime, startColor.g, g);
-        color.b = map(i, 0, fadeTime, startColor.b, b);
+    activeLayers &= ~(1 << (layer - 1));
+    composeDirty = true;
+}
+
+// Fades from whatever is currently showing, so calling this mid fade retargets
+// the fade from the current interpolated color. fadeTime is in milliseconds.
+//
+// The fade runs off the wall clock rather than a frame count. Everything that
+// needs a division is worked out here, once, so each frame only costs a
+// multiply for the progress and a multiply and shift per channel.
+void NeoPixelRing::fadeColor(uint8_t r, uint8_t g, uint8_t b, uint32_t fadeTime)
+{
+    uint32_t duration = fadeTime * 1000;
 
-        setColor(&color);
-        vTaskDelay((portTickType) 10);
+    if (duration == 0) {
+        setColor(r, g, b);
+        return;
     }
 
-    setColor(r, g, b);
-    vTaskDelay((portTickType) 10);
+    getColor(&startColor);
+    endColor = {r, g, b};
+
+    // Per channel change, scaled by a 0.16 fixed point progress (0 to 0xFFFF)
+    fadeDelta[0] = (int16_t)endColor.r - startColor.r;
+    fadeDelta[1] = (int16_t)endColor.g - startColor.g;
+    fadeDelta[2] = (int16_t)endColor.b - startColor.b;
+
+    // 1 / duration in 0.32 fixed point, so progress is (elapsed * reciprocal) >> 16
+    fadeReciprocal = (uint32_t)(((1ULL << 32) - 1) / duration);
+    fadeStart = esp_timer_get_time();
+
+    startEffect(EFFECT_FADE, 0, 1);
 }
 
-void NeoPixelRing::fadeColor(RGB_t *endColor, uint16_t fadeTime)
+void NeoPixelRing::fadeColor(RGB_t *endColor, uint32_t fadeTime)
 {
     fadeColor(endColor->r, endColor->g, endColor->b, fadeTime);
 }
 
+uint32_t NeoPixelRing::getFramesShown(void)
+{
+    return framesShown;
+}
+
+uint32_t NeoPixelRing::getFramesSkipped(void)
+{
+    return framesSkipped;
+}
+
+uint8_t NeoPixelRing::getBrightness(void)
+{
+    return brightness;
+}
+
+RingEffect_t NeoPixelRing::getEffect(void)
+{
+    return effect;
+}
+
 void NeoPixelRing::getColor(RGB_t *color)
 {
     // TODO: Whatever color the greatest number of pixel is, return that.
-    uint32_t currentColor = neoPixel->getPixelColor(0);
+    uint32_t currentColor = colors[0];
 
     color->r = (uint8_t)(currentColor >> 16);
     color->g = (uint8_t)(currentColor >> 8);
     color->b = (uint8_t)(currentColor);
 }
 
+// Where the ring is headed, the current color when nothing is running
+void NeoPixelRing::getTargetColor(RGB_t *color)
+{
+    if (effect == EFFECT_FADE || effect == EFFECT_WIPE) {
+        *color = endColor;
+        return;
+    }
+
+    getColor(color);
+}
+
+bool NeoPixelRing::hasLayers(void)
+{
+    return activeLayers != 0;
+}
+
+bool NeoPixelRing::isAnimating(void)
+{
+    return effect != EFFECT_NONE;
+}
+
 void NeoPixelRing::off(void)
 {
     setColor(0,0,0);
@@ -68,85 +468,239 @@ void NeoPixelRing::off(void)
 
 void NeoPixelRing::setColor(uint8_t r, uint8_t g, uint8_t b)
 {
-    uint16_t i;
-    for (i = 0; i < neoPixel->numPixels(); i++) {
-        neoPixel->setPixelColor(i, r, g, b);
+    stop();
+    fill(r, g, b);
+}
+
+void NeoPixelRing::setColor(RGB_t *color)
+{
+    setColor(color->r, color->g, color->b);
+}
+
+// Scales everything that's shown, without changing the colors that were set
+void NeoPixelRing::setBrightness(uint8_t brightness)
+{
+    if (this->brightness == brightness) {
+        return;
     }
 
-    neoPixel->show();
+    this->brightness = brightness;
+    buildOutputTable();
+    if (colors) {
+        refresh();
+    }
 }
 
-void NeoPixelRing::setColor(RGB_t *color)
+void NeoPixelRing::setGammaCorrection(bool enabled)
+{
+    if (gammaCorrection == enabled) {
+        return;
+    }
+
+    gammaCorrection = enabled;
+    buildOutputTable();
+    if (colors) {
+        refresh();
+    }
+}
+
+// NULL goes back to neoPixel->show()
+void NeoPixelRing::setOutput(PixelOutput_t output, void *context)
+{
+    this->output = output;
+    this->outputContext = context;
+}
+
+// Shows a frame of [r, g, b] per pixel, stopping whatever effect was running.
+// Unless `corrected`, the frame goes into the strip's buffer as it came, gamma
+// and brightness are skipped until the next color or effect.
+void NeoPixelRing::showFrame(const uint8_t *frame, bool corrected)
 {
     uint16_t i;
+
+    stop();
+    if (rawFrame == corrected) {
+        // Every pixel has to be written the other way, not just the changed ones
+        rawFrame = !corrected;
+        composeDirty = true;
+    }
     for (i = 0; i < neoPixel->numPixels(); i++) {
-        neoPixel->setPixelColor(i, color->r, color->g, color->b);
+        setPixel(i, neoPixel->Color(frame[0], frame[1], frame[2]));
+        frame += 3;
     }
 
-    neoPixel->show();
+    show();
 }
 
+// Each step of the rainbow is held for `wait` frames
 void NeoPixelRing::rainbow(uint8_t wait)
 {
-    uint16_t i, j;
-    for (j = 0; j < 256; j++) {
-        for(i = 0; i < neoPixel->numPixels(); i++) {
-            neoPixel->setPixelColor(i, wheel((i + j) & 255));
-        }
-
-        neoPixel->show();
-        vTaskDelay((portTickType) wait);
-    }
+    startEffect(EFFECT_RAINBOW, 256, wait);
 }
 
+// Each step of the rainbow cycle is held for `wait` frames
 void NeoPixelRing::rainbowCycle(uint8_t wait)
 {
-    uint16_t i, j;
-    uint16_t cycles = (256 * 5); // 5 cycles of all colors on wheel
+    startEffect(EFFECT_RAINBOW_CYCLE, 256 * 5, wait); // 5 cycles of all colors on wheel
+}
 
-    for (j = 0; j < cycles; j++) {
-        for (i = 0; i < neoPixel->numPixels(); i++) {
-            neoPixel->setPixelColor(i, wheel(((i * 256 / neoPixel->numPixels()) + j) & 255));
-        }
+// Pushes every pixel out again, for when something else has written to the strip
+void NeoPixelRing::redraw(void)
+{
+    refresh();
+}
 
-        neoPixel->show();
-        vTaskDelay((portTickType) wait);
+// Plays a program on top of the ring, `layer` is 1 - EFFECT_MAX_LAYERS. It
+// replaces whatever that layer was playing, and leaves the ring's own effect
+// running underneath. Does nothing with fewer than two keyframes.
+void NeoPixelRing::runLayer(uint8_t layer, const EffectProgram_t *program, EffectBlend_t blend, uint8_t opacity)
+{
+    RingLayer_t *target;
+
+    if (layer < 1 || layer > EFFECT_MAX_LAYERS || program->keyframeCount < 2) {
+        return;
     }
+
+    target = &layers[layer - 1];
+    target->program = *program;
+    target->programStart = esp_timer_get_time();
+    target->loopsPlayed = 0;
+    target->at = 0;
+    target->color = program->keyframes[0].color;
+    target->blend = blend;
+    target->alpha = opacity + (opacity >> 7); // 255 is 256, fully opaque
+
+    activeLayers |= (1 << (layer - 1));
+    composeDirty = true;
 }
 
-uint32_t NeoPixelRing::wheel(uint8_t wheelPos)
+// Plays a parsed effect program, NULL replays the last one. Does nothing when
+// no program was ever given.
+void NeoPixelRing::runProgram(const EffectProgram_t *program)
+{
+    if (program) {
+        this->program = *program;
+    }
+
+    if (this->program.keyframeCount < 2) {
+        return;
+    }
+
+    programStart = esp_timer_get_time();
+    loopsPlayed = 0;
+    startEffect(EFFECT_PROGRAM, 0, 1);
+}
+
+void NeoPixelRing::stop(void)
+{
+    effect = EFFECT_NONE;
+}
+
+// Renders one frame of the active effect and the layers on top of it.
+// Returns true while either has frames left to render.
+bool NeoPixelRing::update(void)
 {
-    wheelPos = 255 - wheelPos;
+    int64_t now = esp_timer_get_time();
+    uint16_t i, j;
+    uint64_t progress;
+    RGB_t color = {0, 0, 0};
+
+    if (activeLayers) {
+        updateLayers(now);
+    }
+
+    switch (effect) {
+        case EFFECT_FADE:
+            progress = ((uint64_t)(now - fadeStart) * fadeReciprocal) >> 16;
+            if (progress >= 0xFFFF) {
+                fill(endColor.r, endColor.g, endColor.b);
+                stop();
+                break;
+            }
+
+            color.r = startColor.r + ((fadeDelta[0] * (int32_t)progress) >> 16);
+            color.g = startColor.g + ((fadeDelta[1] * (int32_t)progress) >> 16);
+            color.b = startColor.b + ((fadeDelta[2] * (int32_t)progress) >> 16);
+            fill(color.r, color.g, color.b);
+            break;
+        case EFFECT_WIPE:
+            setPixel(frame, neoPixel->Color(endColor.r, endColor.g, endColor.b));
+            show();
+            if (++frame >= neoPixel->numPixels()) {
+                stop();
+            }
+            break;
+        case EFFECT_RAINBOW:
+        case EFFECT_RAINBOW_CYCLE:
+            if (holdCount == 0) {
+                j = frame;
+                if (effect == EFFECT_RAINBOW) {
+                    for (i = 0; i < neoPixel->numPixels(); i++) {
+                        setPixel(i, wheelTable[(uint8_t)(i + j)]);
+                    }
+                } else {
+                    for (i = 0; i < neoPixel->numPixels(); i++) {
+                        setPixel(i, wheelTable[(uint8_t)(phases[i] + j)]);
+                    }
+                }
+
+                show();
+            }
+
+            if (++holdCount < frameInterval) {
+                break;
+            }
+
+            holdCount = 0;
+            if (++frame >= frameCount) {
+                stop();
+            }
+            break;
+        case EFFECT_PROGRAM:
+            if (!programPosition(&program, now, &programStart, &loopsPlayed, &j)) {
+                color = program.keyframes[program.keyframeCount - 1].color;
+                fill(color.r, color.g, color.b);
+                stop();
+                break;
+            }
+
+            if (!program.spread) {
+                sampleEffectProgram(&program, j, &color);
+                fill(color.r, color.g, color.b);
+                break;
+            }
+
+            for (i = 0; i < neoPixel->numPixels(); i++) {
+                sampleEffectProgram(&program, spreadOffset(&program, j, phases[i]), &color);
+                setPixel(i, neoPixel->Color(color.r, color.g, color.b));
+            }
 
-    if (wheelPos < 85) {
-        return neoPixel->Color(255 - wheelPos * 3, 0, wheelPos * 3);
+            show();
+            break;
+        case EFFECT_NONE:
+            break;
     }
 
-    if (wheelPos < 170) {
-        wheelPos -= 85;
-        return neoPixel->Color(0, wheelPos * 3, 255 - wheelPos * 3);
+    // Nothing underneath showed this frame, but a layer moved
+    if (composeDirty) {
+        show();
     }
 
-    wheelPos -= 170;
-    return neoPixel->Color(wheelPos * 3, 255 - wheelPos * 3, 0);
+    return isAnimating() || hasLayers();
+}
+
+uint32_t NeoPixelRing::wheel(uint8_t wheelPos)
+{
+    return wheelTable[wheelPos];
 }
 
 void NeoPixelRing::wipeColor(uint8_t r, uint8_t g, uint8_t b)
 {
-    uint16_t i;
-    for (i = 0; i < neoPixel->numPixels(); i++) {
-        neoPixel->setPixelColor(i, r, g, b);
-        neoPixel->show();
-        vTaskDelay((portTickType) 10);
-    }
+    endColor = {r, g, b};
+    startEffect(EFFECT_WIPE, neoPixel->numPixels(), 1);
 }
 
 void NeoPixelRing::wipeColor(RGB_t *color)
 {
-    uint16_t i;
-    for (i = 0; i < neoPixel->numPixels(); i++) {
-        neoPixel->setPixelColor(i, color->r, color->g, color->b);
-        neoPixel->show();
-        vTaskDelay((portTickType) 10);
-    }
+    wipeColor(color->r, color->g, color->b);
 }
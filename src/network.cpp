@@ -0,0 +1,202 @@
+#include "config.h"
+#include "globals.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <esp_timer.h>
+#include <mqtt_client.h>
+#include <string.h>
+
+#include "actionQueue.h"
+#include "log.h"
+#include "memoryAudit.h"
+#include "metrics.h"
+#include "mqttEventProcessing.h"
+#include "network.h"
+#include "stateStore.h"
+#include "timeSync.h"
+
+#define WIFI_CACHE_KEY "wifi"
+
+typedef struct WifiCache {
+    uint8_t bssid[6];
+    int32_t channel;
+} WifiCache_t;
+
+//==============================================================================
+// State
+
+// Only touched from setup() and then the WiFi event task
+static Preferences preferences;
+static esp_mqtt_client_handle_t mqttClientHandle = NULL;
+static WifiCache_t wifiCache;
+static bool hasCache = false;
+static bool connectedOnce = false;
+static bool mqttStarted = false;
+
+AUDIT_STATIC("network", wifiCache);
+
+// Only touched from the mqtt task's events, the timer just queues an action
+static TimerHandle_t reconnectTimer = NULL;
+static uint8_t reconnectAttempts = 0;
+
+//==============================================================================
+// Helpers
+
+static void saveWifiCache(void)
+{
+    WifiCache_t current;
+    uint8_t *bssid = WiFi.BSSID();
+
+    if (!bssid) {
+        return;
+    }
+
+    memcpy(current.bssid, bssid, sizeof(current.bssid));
+    current.channel = WiFi.channel();
+
+    // Flash only gets written when the access point changed
+    if (hasCache && memcmp(&current, &wifiCache, sizeof(WifiCache_t)) == 0) {
+        return;
+    }
+
+    preferences.putBytes(WIFI_CACHE_KEY, &current, sizeof(WifiCache_t));
+    wifiCache = current;
+    hasCache = true;
+}
+
+static void onWifiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+    switch (event) {
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+            Serial.print(F("WiFi connected, IP address: "));
+            Serial.println(WiFi.localIP());
+
+            connectedOnce = true;
+            saveWifiCache();
+            startTimeSync();
+
+            if (!mqttStarted) {
+                esp_mqtt_client_start(mqttClientHandle);
+                mqttStarted = true;
+            }
+            break;
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+            // The cached access point is gone (or moved channel), scan for it instead
+            if (!connectedOnce && hasCache) {
+                APP_LOGF("cached access point failed (reason %u), scanning\n", info.wifi_sta_disconnected.reason);
+                preferences.remove(WIFI_CACHE_KEY);
+                hasCache = false;
+                WiFi.disconnect();
+                WiFi.begin(WLAN_SSID, WLAN_PASS);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// The wait before the next attempt: the backoff doubles per failed attempt,
+// and the wait is somewhere in its upper half so the fleet doesn't retry in
+// lockstep
+static uint32_t reconnectDelay(void)
+{
+    uint32_t backoff = MQTT_RECONNECT_MIN_MS;
+    uint8_t i;
+
+    for (i = 0; i < reconnectAttempts && backoff < MQTT_RECONNECT_MAX_MS; i++) {
+        backoff <<= 1;
+    }
+    if (backoff > MQTT_RECONNECT_MAX_MS) {
+        backoff = MQTT_RECONNECT_MAX_MS;
+    }
+
+    return backoff / 2 + esp_random() % (backoff / 2 + 1);
+}
+
+// esp_mqtt_client_reconnect() waits on the client's lock, which the mqtt task
+// holds through a whole handshake, so the timer task hands it off
+static void reconnectTimerCallback(TimerHandle_t timer)
+{
+    signalShortTask(SIGNAL_RECONNECT_MQTT);
+}
+
+// Every failed connect comes back through MQTT_EVENT_DISCONNECTED too
+static void onMqttEvent(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    uint32_t delay;
+
+    switch ((esp_mqtt_event_id_t)event_id) {
+        case MQTT_EVENT_CONNECTED:
+            reconnectAttempts = 0;
+            xTimerStop(reconnectTimer, 0);
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            delay = reconnectDelay();
+            if (reconnectAttempts < UINT8_MAX) {
+                reconnectAttempts++;
+            }
+
+            APP_LOGF("mqtt reconnect %u in %u ms\n", reconnectAttempts, delay);
+            xTimerChangePeriod(reconnectTimer, pdMS_TO_TICKS(delay), 0);
+            break;
+        default:
+            break;
+    }
+}
+
+//==============================================================================
+// Network functions
+
+void startNetwork(esp_mqtt_client_handle_t client)
+{
+    mqttClientHandle = client;
+
+    // Changing the period starts it, the first disconnect sets the real one
+    reconnectTimer = xTimerCreate("Mqtt Reconnect", pdMS_TO_TICKS(MQTT_RECONNECT_MIN_MS), pdFALSE, NULL, reconnectTimerCallback);
+    APP_FAIL_IF(!reconnectTimer, F("Failed to create the mqtt reconnect timer"));
+    esp_mqtt_client_register_event(client, MQTT_EVENT_CONNECTED, onMqttEvent, NULL);
+    esp_mqtt_client_register_event(client, MQTT_EVENT_DISCONNECTED, onMqttEvent, NULL);
+
+    preferences.begin(STATE_STORE_NAMESPACE, false);
+    hasCache = preferences.getBytes(WIFI_CACHE_KEY, &wifiCache, sizeof(WifiCache_t)) == sizeof(WifiCache_t);
+
+    Serial.print(F("Connecting to "));
+    Serial.println(WLAN_SSID);
+
+    WiFi.onEvent(onWifiEvent);
+    WiFi.persistent(false); // The cache above is all that needs saving, not the whole config on every begin()
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(true);
+
+#if defined(WLAN_STATIC_IP)
+    IPAddress ip, gateway, subnet, dns;
+    ip.fromString(WLAN_STATIC_IP);
+    gateway.fromString(WLAN_GATEWAY);
+    subnet.fromString(WLAN_SUBNET);
+#if defined(WLAN_DNS)
+    dns.fromString(WLAN_DNS);
+#else
+    dns = gateway;
+#endif
+    WiFi.config(ip, gateway, subnet, dns);
+#endif
+
+    if (hasCache) {
+        WiFi.begin(WLAN_SSID, WLAN_PASS, wifiCache.channel, wifiCache.bssid);
+    } else {
+        WiFi.begin(WLAN_SSID, WLAN_PASS);
+    }
+}
+
+void reconnectMqtt(void)
+{
+    // Fails harmlessly if the client isn't waiting to reconnect any more
+    esp_mqtt_client_reconnect(mqttClientHandle);
+}
@@ -0,0 +1,300 @@
+#include "config.h"
+#include "globals.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <esp_timer.h>
+
+#include "frameStream.h"
+#include "log.h"
+#include "memoryAudit.h"
+#include "metrics.h"
+#include "mqttEventProcessing.h"
+#include "neoPixelRing.h"
+#include "render.h"
+#include "renderChannel.h"
+#include "ringState.h"
+#include "rmtOutput.h"
+#include "segment.h"
+#include "statusPublisher.h"
+#include "trace.h"
+
+//==============================================================================
+// Process Tasks
+
+static uint32_t framesShown[SEGMENT_COUNT];
+static uint8_t animating = 0; // Bit per segment
+
+// Scenes waiting for their start, at most one per segment
+static RenderCommand_t scenes[SEGMENT_COUNT];
+static uint8_t pendingScenes = 0; // Bit per segment
+
+// Sequences being played, see ColorSequence_t
+typedef struct SequencePlayer {
+    ColorSequence_t sequence;
+    uint8_t step;
+    bool holding;
+    int64_t holdUntil;
+} SequencePlayer_t;
+
+static SequencePlayer_t players[SEGMENT_COUNT];
+static uint8_t playingSequences = 0; // Bit per segment
+
+AUDIT_STATIC("render", scenes);
+AUDIT_STATIC("render", players);
+
+// Stands in for a paused segment's output, its ring carries on but nothing reaches the pin
+static void discardOutput(void *context, const uint8_t *pixels, uint16_t length)
+{
+}
+
+static void applyRenderCommand(const RenderCommand_t *command)
+{
+    Segment_t *segment = &segments[command->segment];
+    SequencePlayer_t *player;
+    bool shown = false;
+
+    switch (command->type) {
+        case RENDER_SET_COLOR:
+            // The latest SET_COLOR wins, whether or not it's a scene
+            pendingScenes &= ~(1 << command->segment);
+            if (command->startAt) {
+                scenes[command->segment] = *command;
+                pendingScenes |= (1 << command->segment);
+                return;
+            }
+
+            playingSequences &= ~(1 << command->segment);
+
+            // An effect plays out in the frames that follow, the status goes out once it's done
+            if (applyColorCommand(segment->ring, &command->command)) {
+                metricsCommandStarted(command->enqueuedAt);
+            } else {
+                shown = true;
+            }
+            break;
+        case RENDER_SET_BRIGHTNESS:
+            segment->ring->setBrightness(command->brightness);
+            break;
+        case RENDER_RUN_PROGRAM:
+            playingSequences &= ~(1 << command->segment);
+            segment->ring->runProgram(command->program);
+            break;
+        case RENDER_RUN_SEQUENCE:
+            player = &players[command->segment];
+            player->sequence = *command->sequence;
+            player->step = 0;
+            player->holding = false;
+            pendingScenes &= ~(1 << command->segment);
+            playingSequences |= (1 << command->segment);
+            applyColorCommand(segment->ring, &player->sequence.steps[0].command);
+            metricsCommandStarted(command->enqueuedAt);
+            break;
+        case RENDER_RUN_LAYER:
+            // Goes on top of whatever is playing, so nothing is cancelled
+            if (command->layer.settings.clear) {
+                segment->ring->clearLayer(command->layer.settings.layer);
+            } else {
+                segment->ring->runLayer(command->layer.settings.layer, command->layer.program,
+                    command->layer.settings.blend, command->layer.settings.opacity);
+            }
+            metricsCommandStarted(command->enqueuedAt);
+            break;
+        case RENDER_PAUSE:
+            segment->ring->setOutput(discardOutput, NULL);
+            break;
+        case RENDER_RESUME:
+#if NEO_PIXEL_RMT
+            attachRmtOutput(segment->output);
+            segment->ring->setOutput(rmtOutputShow, segment->output);
+#else
+            segment->ring->setOutput(NULL, NULL);
+#endif
+            segment->ring->redraw();
+            break;
+    }
+
+    updateRingState(command->segment);
+
+    // Only once the snapshot has the new color, the status is built from it
+    if (shown) {
+        metricsCommandShown(command->enqueuedAt);
+        queueRgbStatus(command->segment);
+    }
+}
+
+// Called once the step's effect is done, holds it and then starts the next
+// one. Returns false once the last step has held.
+static bool playSequence(uint8_t index)
+{
+    SequencePlayer_t *player = &players[index];
+    int64_t now = esp_timer_get_time();
+
+    if (!player->holding) {
+        player->holding = true;
+        player->holdUntil = now + (int64_t)player->sequence.steps[player->step].hold * FADE_TIME_UNIT_MS * 1000;
+    }
+
+    if (now < player->holdUntil) {
+        return true;
+    }
+
+    if (++player->step >= player->sequence.count) {
+        playingSequences &= ~(1 << index);
+        return false;
+    }
+
+    player->holding = false;
+    applyColorCommand(segments[index].ring, &player->sequence.steps[player->step].command);
+
+    return true;
+}
+
+// Advances one segment a frame
+static bool renderSegment(uint8_t index)
+{
+    Segment_t *segment = &segments[index];
+    NeoPixelRing *ring = segment->ring;
+    const uint8_t *streamFrame = NULL;
+    bool isAnimating;
+
+    // A streamed frame takes over from whatever effect is running
+    streamFrame = frameStreamRead(index);
+    if (streamFrame) {
+        playingSequences &= ~(1 << index);
+        ring->showFrame(streamFrame, STREAM_FRAME_CORRECTION);
+        isAnimating = false;
+    } else {
+        isAnimating = ring->update();
+        if (!isAnimating && (playingSequences & (1 << index))) {
+            isAnimating = playSequence(index);
+        }
+    }
+    updateRingState(index);
+
+    return isAnimating;
+}
+
+void applyRenderCommands(void)
+{
+    drainRenderCommands(applyRenderCommand);
+}
+
+// Starts every scene that's due. Its latency is counted from when it was
+// meant to start, so it shows how far off the group was.
+static void startScenes(int64_t now)
+{
+    RenderCommand_t command;
+    uint8_t i;
+
+    for (i = 0; pendingScenes && i < SEGMENT_COUNT; i++) {
+        if (!(pendingScenes & (1 << i)) || (int32_t)((uint32_t)now - scenes[i].startAt) < 0) {
+            continue;
+        }
+
+        command = scenes[i];
+        command.enqueuedAt = command.startAt;
+        command.startAt = 0;
+        applyRenderCommand(&command);
+    }
+}
+
+// Ticks until the next scene is due, portMAX_DELAY when there aren't any
+static TickType_t ticksUntilScene(void)
+{
+    int64_t now = esp_timer_get_time();
+    int32_t wait;
+    int32_t soonest = INT32_MAX;
+    uint8_t i;
+
+    if (!pendingScenes) {
+        return portMAX_DELAY;
+    }
+
+    for (i = 0; i < SEGMENT_COUNT; i++) {
+        if (pendingScenes & (1 << i)) {
+            wait = (int32_t)(scenes[i].startAt - (uint32_t)now);
+            soonest = wait < soonest ? wait : soonest;
+        }
+    }
+
+    // Rounded up, waking early would only mean waiting again
+    return soonest <= 0 ? 0 : pdMS_TO_TICKS((soonest + 999) / 1000) + 1;
+}
+
+// Applies every command that came in since the last frame, then advances
+// every segment one frame. Returns a bit per segment that's still running an
+// effect. With NEO_PIXEL_RMT a show only starts the frame going out, so every
+// segment's frame is on the wire at once. Split out of the task so the bench
+// can step it without a scheduler.
+uint8_t renderFrame(void)
+{
+    int64_t frameStart = esp_timer_get_time();
+    uint32_t shown = 0;
+    uint8_t i;
+
+    TRACE(TRACE_FRAME_START, 0);
+
+    applyRenderCommands();
+    startScenes(frameStart);
+
+    for (i = 0; i < SEGMENT_COUNT; i++) {
+        if (renderSegment(i)) {
+            animating |= (1 << i);
+        } else {
+            animating &= ~(1 << i);
+        }
+
+        shown += segments[i].ring->getFramesShown() - framesShown[i];
+        framesShown[i] = segments[i].ring->getFramesShown();
+    }
+
+    metricsFrameRendered((uint32_t)(esp_timer_get_time() - frameStart), shown != 0);
+    TRACE(TRACE_FRAME_END, shown != 0);
+
+    return animating;
+}
+
+void processRenderTask(void *parameter)
+{
+    TickType_t lastFrame = xTaskGetTickCount();
+    uint8_t wasAnimating = 0;
+    uint8_t isAnimating = 0;
+    TickType_t sceneWait;
+    uint8_t finished;
+    uint8_t i;
+
+    while (1) {
+        // Nothing moves while every ring is still, so sleep until a command
+        // or a streamed frame comes in instead of ticking through empty frames.
+        // A scene wakes it on its own tick, rather than on whichever frame
+        // comes after it.
+        sceneWait = ticksUntilScene();
+        if (isAnimating && sceneWait == portMAX_DELAY) {
+            vTaskDelayUntil(&lastFrame, pdMS_TO_TICKS(RENDER_FRAME_MS));
+        } else {
+            if (isAnimating && sceneWait > pdMS_TO_TICKS(RENDER_FRAME_MS)) {
+                sceneWait = pdMS_TO_TICKS(RENDER_FRAME_MS);
+            }
+            ulTaskNotifyTake(pdTRUE, sceneWait);
+            lastFrame = xTaskGetTickCount();
+        }
+
+        isAnimating = renderFrame();
+
+        // Let everyone know where the rings ended up
+        finished = wasAnimating & ~isAnimating;
+        for (i = 0; finished && i < SEGMENT_COUNT; i++) {
+            if (finished & (1 << i)) {
+                APP_LOG(F("processRenderTask() effect finished"));
+                APP_LOGF("  segment %u, frames shown: %u, skipped: %u\n", i, segments[i].ring->getFramesShown(), segments[i].ring->getFramesSkipped());
+                queueRgbStatus(i);
+            }
+        }
+
+        wasAnimating = isAnimating;
+    }
+}
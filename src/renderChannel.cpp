@@ -0,0 +1,116 @@
+#include "config.h"
+#include "globals.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "memoryAudit.h"
+#include "metrics.h"
+#include "render.h"
+#include "renderChannel.h"
+
+// How long a sender sleeps before checking again, in case a wakeup was missed
+#define RENDER_CHANNEL_WAIT pdMS_TO_TICKS(RENDER_FRAME_MS)
+
+//==============================================================================
+// Channels
+
+// `head` and `tail` run freely and wrap, only their difference matters. The
+// sender owns `head`, the render task owns `tail`, and `waiting` is the task
+// (if any) sleeping until `tail` moves. Zero is a valid starting state.
+typedef struct RenderChannel {
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<TaskHandle_t> waiting;
+    RenderCommand_t commands[RENDER_CHANNEL_LENGTH];
+} RenderChannel_t;
+
+static RenderChannel_t channels[RENDER_SENDER_COUNT];
+
+AUDIT_STATIC("render_channel", channels);
+
+//==============================================================================
+// Helpers
+
+// Sleeps until the render task has read the command in slot `until` - 1
+static void waitForTail(RenderChannel_t *channel, uint32_t until)
+{
+    while ((int32_t)(channel->tail.load() - until) < 0) {
+        // Checked again after saying we're waiting, so a read that lands in
+        // between still wakes us
+        channel->waiting.store(xTaskGetCurrentTaskHandle());
+        if ((int32_t)(channel->tail.load() - until) >= 0) {
+            channel->waiting.store(NULL);
+            break;
+        }
+
+        wakeRenderTask();
+        ulTaskNotifyTake(pdTRUE, RENDER_CHANNEL_WAIT);
+    }
+}
+
+//==============================================================================
+// Channel functions
+
+void sendRenderCommand(RenderSender_t sender, const RenderCommand_t *command)
+{
+    RenderChannel_t *channel = &channels[sender];
+    uint32_t head = channel->head.load(std::memory_order_relaxed);
+
+    if (head - channel->tail.load(std::memory_order_acquire) >= RENDER_CHANNEL_LENGTH) {
+        metricsCount(METRIC_RENDER_WAITS);
+        waitForTail(channel, head - RENDER_CHANNEL_LENGTH + 1);
+    }
+
+    channel->commands[head & (RENDER_CHANNEL_LENGTH - 1)] = *command;
+    channel->head.store(head + 1, std::memory_order_release);
+
+    wakeRenderTask();
+}
+
+void wakeRenderTask(void)
+{
+    // NULL until setup() starts it, nothing has to wake it before then
+    if (renderTaskHandle) {
+        xTaskNotifyGive(renderTaskHandle);
+    }
+}
+
+void syncRenderCommands(RenderSender_t sender)
+{
+    RenderChannel_t *channel = &channels[sender];
+
+    waitForTail(channel, channel->head.load(std::memory_order_relaxed));
+}
+
+void drainRenderCommands(RenderCommandHandler_t handler)
+{
+    RenderChannel_t *channel;
+    TaskHandle_t waiting;
+    uint32_t tail;
+    uint8_t i;
+
+    for (i = 0; i < RENDER_SENDER_COUNT; i++) {
+        channel = &channels[i];
+        tail = channel->tail.load(std::memory_order_relaxed);
+        if (tail == channel->head.load(std::memory_order_acquire)) {
+            continue;
+        }
+
+        // Handled in place, the slot isn't given back until it's done with
+        while (tail != channel->head.load(std::memory_order_acquire)) {
+            handler(&channel->commands[tail & (RENDER_CHANNEL_LENGTH - 1)]);
+            channel->tail.store(++tail);
+        }
+
+        if (channel->waiting.load()) {
+            waiting = channel->waiting.exchange(NULL);
+            if (waiting) {
+                xTaskNotifyGive(waiting);
+            }
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#include <Arduino.h>
+#include <atomic>
+
+#include "led.h"
+#include "memoryAudit.h"
+#include "neoPixelRing.h"
+#include "ringState.h"
+#include "segment.h"
+
+//==============================================================================
+// State
+
+// One seqlock per segment, zero is a valid (even) starting sequence
+static std::atomic<uint32_t> sequences[SEGMENT_COUNT];
+static RingState_t snapshots[SEGMENT_COUNT];
+
+// The writer's own copy of the last snapshot, only touched by the writer
+static RingState_t lastWritten[SEGMENT_COUNT];
+
+AUDIT_STATIC("ring_state", snapshots);
+AUDIT_STATIC("ring_state", lastWritten);
+
+//==============================================================================
+// State functions
+
+void updateRingState(uint8_t segment)
+{
+    NeoPixelRing *ring = segments[segment].ring;
+    std::atomic<uint32_t> *sequence = &sequences[segment];
+    RingState_t state;
+    uint32_t seq;
+
+    ring->getColor(&state.current);
+    ring->getTargetColor(&state.target);
+    state.brightness = ring->getBrightness();
+    state.effect = ring->getEffect();
+
+    if (memcmp(&state, &lastWritten[segment], sizeof(RingState_t)) == 0) {
+        return;
+    }
+
+    lastWritten[segment] = state;
+
+    // An odd sequence tells readers a write is in progress
+    seq = sequence->load(std::memory_order_relaxed);
+    sequence->store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    snapshots[segment] = state;
+    sequence->store(seq + 2, std::memory_order_release);
+}
+
+uint32_t readRingState(uint8_t segment, RingState_t *state)
+{
+    std::atomic<uint32_t> *sequence = &sequences[segment];
+    uint32_t before, after;
+
+    do {
+        before = sequence->load(std::memory_order_acquire);
+        *state = snapshots[segment];
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence->load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    return before;
+}
@@ -0,0 +1,151 @@
+#include "config.h"
+#include "globals.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <driver/rmt.h>
+#include <string.h>
+
+#include "log.h"
+#include "memoryAudit.h"
+#include "rmtOutput.h"
+#include "segment.h"
+
+// WS2812 bit timings
+#define WS2812_T0H_NS 400
+#define WS2812_T0L_NS 850
+#define WS2812_T1H_NS 800
+#define WS2812_T1L_NS 450
+
+#define RMT_CLOCK_DIVIDER 2 // 40MHz, 25ns ticks
+
+//==============================================================================
+// State
+
+struct RmtOutput {
+    rmt_channel_t channel;
+    gpio_num_t gpio;
+    uint8_t *txBuffer;
+    uint16_t txLength;
+};
+
+static_assert(NEO_PIXEL_RMT_CHANNEL + 1 >= SEGMENT_COUNT, "not enough rmt channels below NEO_PIXEL_RMT_CHANNEL for every segment");
+
+static RmtOutput_t outputs[SEGMENT_COUNT];
+
+AUDIT_STATIC("rmt", outputs);
+
+// Worked out from the counter clock once, then only read by the translators.
+// Every channel runs off the same clock, so they share them.
+static rmt_item32_t bit0;
+static rmt_item32_t bit1;
+
+//==============================================================================
+// Helpers
+
+// Called by the RMT driver, from its interrupt, whenever the channel needs more items
+static void IRAM_ATTR ws2812Translate(
+    const void *src,
+    rmt_item32_t *dest,
+    size_t srcSize,
+    size_t wantedNum,
+    size_t *translatedSize,
+    size_t *itemNum
+) {
+    const uint8_t *data = (const uint8_t *)src;
+    size_t size = 0;
+    size_t num = 0;
+    uint8_t bit;
+
+    if (src == NULL || dest == NULL) {
+        *translatedSize = 0;
+        *itemNum = 0;
+        return;
+    }
+
+    while (size < srcSize && num + 8 <= wantedNum) {
+        for (bit = 0; bit < 8; bit++) {
+            dest->val = (data[size] & (0x80 >> bit)) ? bit1.val : bit0.val;
+            dest++;
+        }
+        num += 8;
+        size++;
+    }
+
+    *translatedSize = size;
+    *itemNum = num;
+}
+
+static uint32_t ticks(uint32_t hz, uint32_t ns)
+{
+    return (uint32_t)(((uint64_t)hz * ns) / 1000000000ULL);
+}
+
+//==============================================================================
+// Rmt output functions
+
+RmtOutput_t *initRmtOutput(uint8_t segment, uint8_t pin, uint16_t length)
+{
+    RmtOutput_t *output = &outputs[segment];
+    rmt_config_t config;
+    uint32_t hz = 0;
+
+    output->channel = (rmt_channel_t)(NEO_PIXEL_RMT_CHANNEL - segment);
+    output->gpio = (gpio_num_t)pin;
+
+    memset(&config, 0, sizeof(rmt_config_t));
+    config.rmt_mode = RMT_MODE_TX;
+    config.channel = output->channel;
+    config.gpio_num = output->gpio;
+    config.clk_div = RMT_CLOCK_DIVIDER;
+    config.mem_block_num = 1;
+    config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+    config.tx_config.idle_output_en = true;
+
+    if (rmt_config(&config) != ESP_OK || rmt_driver_install(output->channel, 0, 0) != ESP_OK) {
+        APP_LOG(F("rmt channel failed to install"));
+        return NULL;
+    }
+
+    rmt_get_counter_clock(output->channel, &hz);
+    bit0.level0 = 1;
+    bit0.duration0 = ticks(hz, WS2812_T0H_NS);
+    bit0.level1 = 0;
+    bit0.duration1 = ticks(hz, WS2812_T0L_NS);
+    bit1.level0 = 1;
+    bit1.duration0 = ticks(hz, WS2812_T1H_NS);
+    bit1.level1 = 0;
+    bit1.duration1 = ticks(hz, WS2812_T1L_NS);
+
+    if (rmt_translator_init(output->channel, ws2812Translate) != ESP_OK) {
+        APP_LOG(F("rmt translator failed to initialize"));
+        return NULL;
+    }
+
+    output->txBuffer = new uint8_t[length]();
+    output->txLength = length;
+
+    return output;
+}
+
+void attachRmtOutput(RmtOutput_t *output)
+{
+    rmt_set_gpio(output->channel, RMT_MODE_TX, output->gpio, false);
+}
+
+// The translator reads the buffer while the frame goes out, so the pixels
+// are copied first and the caller is free to start on the next frame (or
+// the next segment's).
+void rmtOutputShow(void *context, const uint8_t *pixels, uint16_t length)
+{
+    RmtOutput_t *output = (RmtOutput_t *)context;
+
+    if (length > output->txLength) {
+        length = output->txLength;
+    }
+
+    // The last frame went out long ago at any sane frame rate, this only waits when shows are back to back
+    rmt_wait_tx_done(output->channel, portMAX_DELAY);
+    memcpy(output->txBuffer, pixels, length);
+    rmt_write_sample(output->channel, output->txBuffer, length, false);
+}
@@ -0,0 +1,101 @@
+#include "config.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <Adafruit_NeoPixel.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "memoryAudit.h"
+#include "neoPixelRing.h"
+#include "segment.h"
+
+//==============================================================================
+// Segments
+
+/**
+ *  Adafruit NeoPixel objects, one per segment
+ *
+ *  Argument 1 = Number of pixels in NeoPixel strip
+ *  Argument 2 = Arduino pin number (most are valid)
+ *  Argument 3 = Pixel type flags, add together as needed:
+ *      NEO_KHZ800  800 KHz bitstream (most NeoPixel products w/WS2812 LEDs)
+ *      NEO_KHZ400  400 KHz (classic 'v1' (not v2) FLORA pixels, WS2811 drivers)
+ *      NEO_GRB     Pixels are wired for GRB bitstream (most NeoPixel products)
+ *      NEO_RGB     Pixels are wired for RGB bitstream (v1 FLORA pixels, not v2)
+ *      NEO_RGBW    Pixels are wired for RGBW bitstream (NeoPixel RGBW products)
+ */
+static Adafruit_NeoPixel neoPixels[SEGMENT_COUNT] = {
+    {segmentPixelCounts[0], segmentPins[0], NEO_GRB + NEO_KHZ800},
+#if SEGMENT_COUNT > 1
+    {segmentPixelCounts[1], segmentPins[1], NEO_GRB + NEO_KHZ800},
+#endif
+#if SEGMENT_COUNT > 2
+    {segmentPixelCounts[2], segmentPins[2], NEO_GRB + NEO_KHZ800},
+#endif
+#if SEGMENT_COUNT > 3
+    {segmentPixelCounts[3], segmentPins[3], NEO_GRB + NEO_KHZ800},
+#endif
+};
+
+static NeoPixelRing rings[SEGMENT_COUNT] = {
+    {&neoPixels[0]},
+#if SEGMENT_COUNT > 1
+    {&neoPixels[1]},
+#endif
+#if SEGMENT_COUNT > 2
+    {&neoPixels[2]},
+#endif
+#if SEGMENT_COUNT > 3
+    {&neoPixels[3]},
+#endif
+};
+
+Segment_t segments[SEGMENT_COUNT];
+
+AUDIT_STATIC("segment", neoPixels);
+AUDIT_STATIC("segment", rings);
+AUDIT_STATIC("segment", segments);
+
+//==============================================================================
+// Segment functions
+
+void initSegments(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < SEGMENT_COUNT; i++) {
+        segments[i].pixels = &neoPixels[i];
+        segments[i].ring = &rings[i];
+        segments[i].output = NULL;
+    }
+}
+
+uint16_t segmentTopic(char *output, const char *topic, uint8_t segment)
+{
+    int length = segment
+        ? snprintf(output, SEGMENT_TOPIC_LEN, "%s/%u", topic, segment)
+        : snprintf(output, SEGMENT_TOPIC_LEN, "%s", topic);
+
+    return (length > 0 && length < SEGMENT_TOPIC_LEN) ? length : 0;
+}
+
+uint16_t parseSegmentTopic(const char *topic, int topicLength, uint8_t *segment)
+{
+    uint8_t digit;
+
+    // Only ever one digit, SEGMENT_MAX_COUNT keeps it that way
+    if (topicLength < 3 || topic[topicLength - 2] != '/') {
+        return 0;
+    }
+
+    digit = (uint8_t)(topic[topicLength - 1] - '0');
+    if (digit < 1 || digit >= SEGMENT_COUNT) {
+        return 0;
+    }
+
+    *segment = digit;
+
+    return topicLength - 2;
+}
@@ -0,0 +1,224 @@
+#include "config.h"
+#include "globals.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <Preferences.h>
+#include <esp_timer.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "actionQueue.h"
+#include "effectProgram.h"
+#include "log.h"
+#include "memoryAudit.h"
+#include "metrics.h"
+#include "mqttEventProcessing.h"
+#include "segment.h"
+#include "stateStore.h"
+
+#define STATE_KEY "ring"
+#define PROGRAM_KEY "program"
+#define KEY_LEN 16 // NVS keys are at most 15 characters
+
+//==============================================================================
+// State
+
+static Preferences preferences;
+static TimerHandle_t storeTimer = NULL;
+
+typedef struct PendingSegment {
+    StoredState_t state;
+    EffectProgram_t program;
+    bool stateDirty;
+    bool programDirty;
+} PendingSegment_t;
+
+// Written by whoever stores, read by the short task when it flushes
+static portMUX_TYPE pendingMux = portMUX_INITIALIZER_UNLOCKED;
+static PendingSegment_t pending[SEGMENT_COUNT];
+static uint8_t dirtySegments = 0; // Bit per segment
+static int64_t dirtySince = 0;    // When the oldest unwritten change came in
+
+// Only touched by the short task
+static StoredState_t writtenStates[SEGMENT_COUNT];
+static EffectProgram_t flushProgram;
+
+AUDIT_STATIC("state_store", pending);
+AUDIT_STATIC("state_store", writtenStates);
+AUDIT_STATIC("state_store", flushProgram);
+
+//==============================================================================
+// Helpers
+
+// "ring" and "program" for segment 0, so saves from before segments still load
+static const char *segmentKey(char *key, const char *name, uint8_t segment)
+{
+    if (segment) {
+        snprintf(key, KEY_LEN, "%s%u", name, segment);
+    } else {
+        snprintf(key, KEY_LEN, "%s", name);
+    }
+
+    return key;
+}
+
+static void storeTimerCallback(TimerHandle_t timer)
+{
+    signalShortTask(SIGNAL_STORE_STATE);
+}
+
+// Call with pendingMux held, before marking the segment dirty
+static bool deferStore(uint8_t segment)
+{
+    int64_t now = esp_timer_get_time();
+
+    if (!dirtySegments) {
+        dirtySince = now;
+    }
+    dirtySegments |= (1 << segment);
+
+    // Past the cap the timer is left to run out, so the write can't be pushed back forever
+    return now - dirtySince < (int64_t)STATE_STORE_MAX_DELAY_MS * 1000;
+}
+
+static void scheduleStore(bool defer)
+{
+    if (defer || !xTimerIsTimerActive(storeTimer)) {
+        xTimerReset(storeTimer, 0);
+    }
+}
+
+static void flushSegment(uint8_t segment)
+{
+    StoredState_t state;
+    StoredState_t *written = &writtenStates[segment];
+    char key[KEY_LEN];
+    bool writeState, writeProgram;
+
+    portENTER_CRITICAL(&pendingMux);
+    state = pending[segment].state;
+    writeState = pending[segment].stateDirty;
+    writeProgram = pending[segment].programDirty;
+    if (writeProgram) {
+        flushProgram = pending[segment].program;
+    }
+    pending[segment].stateDirty = false;
+    pending[segment].programDirty = false;
+    portEXIT_CRITICAL(&pendingMux);
+
+    // The program goes first, so a stored command never points at a program that isn't there yet
+    if (writeProgram) {
+        preferences.putBytes(segmentKey(key, PROGRAM_KEY, segment), &flushProgram, sizeof(EffectProgram_t));
+        metricsCount(METRIC_NVS_WRITES);
+    }
+
+    // A written version of 0 means nothing was loaded or written yet, so the first store always goes out
+    if (writeState && (state.version != written->version
+        || state.brightness != written->brightness
+        || memcmp(&state.command, &written->command, sizeof(ColorCommand_t)) != 0)) {
+        preferences.putBytes(segmentKey(key, STATE_KEY, segment), &state, sizeof(StoredState_t));
+        metricsCount(METRIC_NVS_WRITES);
+        *written = state;
+    }
+}
+
+//==============================================================================
+// State store functions
+
+bool initStateStore(void)
+{
+    uint8_t segment;
+
+    memset(pending, 0, sizeof(pending));
+    memset(writtenStates, 0, sizeof(writtenStates));
+    for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+        pending[segment].state.version = STATE_STORE_VERSION;
+        pending[segment].state.brightness = NEO_PIXEL_BRIGHTNESS;
+    }
+    storeTimer = xTimerCreate("State Store", pdMS_TO_TICKS(STATE_STORE_DELAY_MS), pdFALSE, NULL, storeTimerCallback);
+
+    return storeTimer != NULL && preferences.begin(STATE_STORE_NAMESPACE, false);
+}
+
+bool loadStoredState(uint8_t segment, StoredState_t *state, EffectProgram_t *program)
+{
+    char key[KEY_LEN];
+
+    if (preferences.getBytes(segmentKey(key, STATE_KEY, segment), state, sizeof(StoredState_t)) != sizeof(StoredState_t)
+        || state->version != STATE_STORE_VERSION) {
+        return false;
+    }
+
+    if (state->command.effect == EFFECT_PROGRAM
+        && preferences.getBytes(segmentKey(key, PROGRAM_KEY, segment), program, sizeof(EffectProgram_t)) != sizeof(EffectProgram_t)) {
+        return false;
+    }
+
+    writtenStates[segment] = *state;
+    pending[segment].state = *state;
+
+    return true;
+}
+
+void storeColorCommand(uint8_t segment, const ColorCommand_t *command)
+{
+    bool defer;
+
+    portENTER_CRITICAL(&pendingMux);
+    defer = deferStore(segment);
+    pending[segment].state.command = *command;
+    pending[segment].stateDirty = true;
+    portEXIT_CRITICAL(&pendingMux);
+
+    scheduleStore(defer);
+}
+
+void storeBrightness(uint8_t segment, uint8_t brightness)
+{
+    bool defer;
+
+    portENTER_CRITICAL(&pendingMux);
+    defer = deferStore(segment);
+    pending[segment].state.brightness = brightness;
+    pending[segment].stateDirty = true;
+    portEXIT_CRITICAL(&pendingMux);
+
+    scheduleStore(defer);
+}
+
+void storeEffectProgram(uint8_t segment, const EffectProgram_t *program)
+{
+    bool defer;
+
+    portENTER_CRITICAL(&pendingMux);
+    defer = deferStore(segment);
+    pending[segment].program = *program;
+    pending[segment].programDirty = true;
+    portEXIT_CRITICAL(&pendingMux);
+
+    scheduleStore(defer);
+}
+
+void flushStoredState(void)
+{
+    APP_LOG(F("flushStoredState()"));
+
+    uint8_t dirty;
+    uint8_t segment;
+
+    portENTER_CRITICAL(&pendingMux);
+    dirty = dirtySegments;
+    dirtySegments = 0;
+    portEXIT_CRITICAL(&pendingMux);
+
+    for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+        if (dirty & (1 << segment)) {
+            flushSegment(segment);
+        }
+    }
+}
@@ -0,0 +1,197 @@
+#include "config.h"
+#include "globals.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <ArduinoJson.h>
+#include <esp_timer.h>
+#include <mqtt_client.h>
+
+#include "actionQueue.h"
+#include "log.h"
+#include "memoryAudit.h"
+#include "metrics.h"
+#include "mqttEventProcessing.h"
+#include "ringState.h"
+#include "segment.h"
+#include "statusPublisher.h"
+#include "trace.h"
+
+#define PAYLOAD_FORMAT_COUNT 2
+#define NEVER_PUBLISHED 1 // Snapshot versions are always even
+
+//==============================================================================
+// State
+
+// Everything but statusFormat is only touched by the short task, so none of it needs locking
+static PayloadFormat_t statusFormat = PAYLOAD_JSON;
+static TickType_t lastPublish = 0;
+static bool hasPublished = false;
+static bool hasPending = false;
+static TimerHandle_t flushTimer = NULL;
+
+typedef struct SegmentStatus {
+    uint8_t pendingFormats; // Bit per PayloadFormat_t
+    uint8_t forcedFormats;  // Bit per PayloadFormat_t
+    uint32_t publishedVersions[PAYLOAD_FORMAT_COUNT];
+    char statusJson[SUBSCRIPTIONDATALEN];
+    size_t statusJsonLength;
+    uint32_t statusJsonVersion;
+    char topics[PAYLOAD_FORMAT_COUNT][SEGMENT_TOPIC_LEN];
+} SegmentStatus_t;
+
+static SegmentStatus_t statuses[SEGMENT_COUNT];
+
+AUDIT_STATIC("status", statuses);
+
+//==============================================================================
+// Helpers
+
+static void flushTimerCallback(TimerHandle_t timer)
+{
+    signalShortTask(SIGNAL_FLUSH_STATUS);
+}
+
+// Reads the ring state snapshot, so this never waits on (or gets turned away
+// by) the render task. The json is only rebuilt when the snapshot changed.
+static void publishRgbStatus(SegmentStatus_t *status, PayloadFormat_t format, const RingState_t *state, uint32_t version)
+{
+    APP_LOG(F("publishRgbStatus()"));
+    TRACE(TRACE_STATUS_PUBLISH, format);
+
+#if defined(BINARY_TOPICS_ENABLED)
+    if (format == PAYLOAD_BINARY) {
+        char output[BINARY_COLOR_LEN] = {(char)state->current.r, (char)state->current.g, (char)state->current.b};
+        esp_mqtt_client_publish(mqttClient, status->topics[PAYLOAD_BINARY], output, BINARY_COLOR_LEN, 0, STATUS_PUBLISH_RETAIN);
+        return;
+    }
+#endif
+
+    if (version != status->statusJsonVersion) {
+        const int capacity = JSON_OBJECT_SIZE(4);
+        StaticJsonDocument<capacity> doc;
+
+        doc["r"] = state->current.r;
+        doc["g"] = state->current.g;
+        doc["b"] = state->current.b;
+        doc["brightness"] = state->brightness;
+
+        status->statusJsonLength = serializeJson(doc, status->statusJson, sizeof(status->statusJson));
+        status->statusJsonVersion = version;
+    }
+
+    esp_mqtt_client_publish(mqttClient, status->topics[PAYLOAD_JSON], status->statusJson, status->statusJsonLength, 0, STATUS_PUBLISH_RETAIN);
+}
+
+//==============================================================================
+// Publisher functions
+
+bool initStatusPublisher(void)
+{
+    uint8_t segment, format;
+
+    // The topics are worked out once, so a publish never formats one
+    for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+        SegmentStatus_t *status = &statuses[segment];
+
+        memset(status, 0, sizeof(SegmentStatus_t));
+        status->statusJsonVersion = NEVER_PUBLISHED;
+        for (format = 0; format < PAYLOAD_FORMAT_COUNT; format++) {
+            status->publishedVersions[format] = NEVER_PUBLISHED;
+        }
+
+        segmentTopic(status->topics[PAYLOAD_JSON], PUB_GET_COLOR, segment);
+#if defined(BINARY_TOPICS_ENABLED)
+        segmentTopic(status->topics[PAYLOAD_BINARY], PUB_GET_COLOR_BIN, segment);
+#endif
+    }
+
+    flushTimer = xTimerCreate("Status Flush", pdMS_TO_TICKS(STATUS_PUBLISH_INTERVAL_MS), pdFALSE, NULL, flushTimerCallback);
+
+    return flushTimer != NULL;
+}
+
+void scheduleRgbStatus(uint8_t segment, PayloadFormat_t format, bool force)
+{
+    SegmentStatus_t *status = &statuses[segment];
+
+    status->pendingFormats |= (1 << format);
+    if (force) {
+        status->forcedFormats |= (1 << format);
+    }
+    hasPending = true;
+
+    flushRgbStatus();
+}
+
+void flushRgbStatus(void)
+{
+    RingState_t state;
+    uint32_t version;
+    uint8_t segment, format;
+    TickType_t now = xTaskGetTickCount();
+    TickType_t elapsed = now - lastPublish;
+
+    if (!hasPending) {
+        return;
+    }
+
+    // Too soon, come back once the interval is up. Anything asked for in the
+    // meantime gets folded into that one publish.
+    if (hasPublished && elapsed < pdMS_TO_TICKS(STATUS_PUBLISH_INTERVAL_MS)) {
+        if (xTimerIsTimerActive(flushTimer) == pdFALSE) {
+            xTimerChangePeriod(flushTimer, pdMS_TO_TICKS(STATUS_PUBLISH_INTERVAL_MS) - elapsed, 0);
+        }
+        return;
+    }
+
+    for (segment = 0; segment < SEGMENT_COUNT; segment++) {
+        SegmentStatus_t *status = &statuses[segment];
+
+        if (!status->pendingFormats) {
+            continue;
+        }
+
+        version = readRingState(segment, &state);
+
+        for (format = 0; format < PAYLOAD_FORMAT_COUNT; format++) {
+            if (!(status->pendingFormats & (1 << format))) {
+                continue;
+            }
+
+            if (version != status->publishedVersions[format] || (status->forcedFormats & (1 << format))) {
+                publishRgbStatus(status, (PayloadFormat_t)format, &state, version);
+                status->publishedVersions[format] = version;
+                lastPublish = now;
+                hasPublished = true;
+            } else {
+                APP_LOG(F("status unchanged, skipping publish"));
+            }
+        }
+
+        status->pendingFormats = 0;
+        status->forcedFormats = 0;
+    }
+
+    hasPending = false;
+}
+
+void queueRgbStatus(uint8_t segment)
+{
+    signalShortTask(SIGNAL_PUBLISH_STATUS_FOR(segment));
+}
+
+void scheduleQueuedRgbStatus(uint8_t segment)
+{
+    scheduleRgbStatus(segment, statusFormat, false);
+}
+
+void setRgbStatusFormat(PayloadFormat_t format)
+{
+    statusFormat = format;
+}
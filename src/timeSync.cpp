@@ -0,0 +1,65 @@
+#include "config.h"
+
+#include <Arduino.h>
+#include <HardwareSerial.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include <sys/time.h>
+#include <atomic>
+
+#include "log.h"
+#include "timeSync.h"
+
+//==============================================================================
+// State
+
+static std::atomic<bool> synced(false);
+static bool started = false; // WiFi event task only
+
+//==============================================================================
+// Helpers
+
+// lwIP's SNTP task, every time the clock is set
+static void onTimeSync(struct timeval *tv)
+{
+    if (!synced.exchange(true, std::memory_order_release)) {
+        APP_LOGF("clock synced, %ld\n", (long)tv->tv_sec);
+    }
+}
+
+//==============================================================================
+// Time functions
+
+void startTimeSync(void)
+{
+    if (started) {
+        return;
+    }
+
+    started = true;
+    sntp_set_time_sync_notification_cb(onTimeSync);
+    configTime(0, 0, SNTP_SERVER);
+}
+
+bool isTimeSynced(void)
+{
+    return synced.load(std::memory_order_acquire);
+}
+
+bool wallTimeToTimer(uint64_t wallTime, int64_t *timerTime)
+{
+    struct timeval now;
+    int64_t timer;
+
+    if (!isTimeSynced()) {
+        return false;
+    }
+
+    // Read back to back, so the two clocks are as close to the same instant as they get
+    gettimeofday(&now, NULL);
+    timer = esp_timer_get_time();
+
+    *timerTime = timer + (int64_t)(wallTime * 1000) - ((int64_t)now.tv_sec * 1000000 + now.tv_usec);
+
+    return true;
+}
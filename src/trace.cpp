@@ -0,0 +1,77 @@
+#include "config.h"
+#include "globals.h"
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <mqtt_client.h>
+#include <atomic>
+
+#include "log.h"
+#include "memoryAudit.h"
+#include "trace.h"
+
+#if defined(APP_TRACE) && APP_TRACE
+
+#if !defined(SUB_TRACE_DUMP) || !defined(PUB_TRACE)
+#error "SUB_TRACE_DUMP and PUB_TRACE must be defined to use APP_TRACE"
+#endif
+
+static_assert((TRACE_BUFFER_SIZE & (TRACE_BUFFER_SIZE - 1)) == 0, "TRACE_BUFFER_SIZE must be a power of two");
+
+//==============================================================================
+// Trace buffer
+
+static TraceRecord_t traceBuffer[TRACE_BUFFER_SIZE];
+static std::atomic<uint32_t> traceHead(0);
+
+// Only the short task dumps, so this needs no locking
+static uint32_t traceTail = 0;
+
+AUDIT_STATIC("trace", traceBuffer);
+
+//==============================================================================
+// Trace functions
+
+// Any task. Each writer claims its own slot, so writers never wait on each
+// other. A dump that races a writer can see that one record half written.
+void traceRecord(TraceEvent_t event, uint16_t arg)
+{
+    uint32_t index = traceHead.fetch_add(1, std::memory_order_relaxed) & (TRACE_BUFFER_SIZE - 1);
+    TraceRecord_t *record = &traceBuffer[index];
+
+    record->timestamp = (uint32_t)esp_timer_get_time();
+    record->event = event;
+    record->arg = arg;
+}
+
+// Short task only
+void publishTrace(void)
+{
+    APP_LOG(F("publishTrace()"));
+
+    uint32_t head = traceHead.load(std::memory_order_relaxed);
+    uint32_t index, count;
+
+    // Skip whatever got overwritten since the last dump
+    if (head - traceTail > TRACE_BUFFER_SIZE) {
+        traceTail = head - TRACE_BUFFER_SIZE;
+    }
+
+    while (traceTail != head) {
+        index = traceTail & (TRACE_BUFFER_SIZE - 1);
+        count = head - traceTail;
+
+        // Chunks can't wrap around the end of the buffer
+        if (count > TRACE_DUMP_CHUNK) {
+            count = TRACE_DUMP_CHUNK;
+        }
+        if (index + count > TRACE_BUFFER_SIZE) {
+            count = TRACE_BUFFER_SIZE - index;
+        }
+
+        esp_mqtt_client_publish(mqttClient, PUB_TRACE, (const char *)&traceBuffer[index], count * sizeof(TraceRecord_t), 0, 0);
+        traceTail += count;
+    }
+}
+
+#endif